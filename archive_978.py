@@ -0,0 +1,500 @@
+#!/usr/bin/env python3
+
+"""
+archive_978.py - Archive and query decoded messages
+===================================================
+
+Keeps the output of ec_978.py in hourly segment files and finds
+messages by time, ADS-B address, or FIS-B ground station.
+
+Each hour (UTC) has three files, named for the hour (such as
+'2022030414'):
+
+* ``.seg``: Records, each a ``RECORD_HEADER`` followed by the message
+  bytes and the rest of the line (';rs=...'). FIS-B packets are stored
+  without their trailing zeros.
+* ``.tix``: Sparse time index. Every ``TIME_INDEX_EVERY`` records, the
+  latest time so far and the offset of the next record.
+* ``.kix``: Key index. The key and offset of every record. The key is
+  the address qualifier and address for ADS-B, or the first 6 bytes of
+  block 0 (station latitude and longitude) for FIS-B, with the record
+  kind in the top byte.
+
+Queries ``mmap`` the files. The time index finds where to start reading,
+and the key index (searched with numpy) finds the records for an
+aircraft or station without reading the others.
+"""
+import sys
+import os
+import glob
+import struct
+import mmap
+import time
+import calendar
+import numpy as np
+import argparse
+from argparse import RawTextHelpFormatter
+
+# Record header: time, key, kind, message length, trailer length.
+RECORD_HEADER = struct.Struct('<dQBHH')
+
+# Record kinds.
+KIND_FISB = 1
+KIND_ADSB = 2
+
+# Bytes in a FIS-B packet (6 blocks of 72 bytes).
+FISB_BYTES = 432
+
+# A time index entry is written every this many records.
+TIME_INDEX_EVERY = 64
+
+# Records can be out of time order (late results from 'ec_978.py --deep').
+# A query stops reading once it sees a record this many seconds after the
+# end of the range.
+LATE_SECS = 120
+
+# Index entry layouts.
+TIME_INDEX_DTYPE = np.dtype([('maxTime', '<f8'), ('offset', '<u8')])
+KEY_INDEX_DTYPE = np.dtype([('key', '<u8'), ('offset', '<u8')])
+
+# Set by --tee. If True, lines read are also written to standard output.
+tee = False
+
+def segmentName(archiveDir, hour):
+  """
+  Get the path of a segment without its extension.
+
+  Args:
+    archiveDir (str): Archive directory.
+    hour (int): Hours since the epoch.
+
+  Returns:
+    str: Path such as 'archive/2022030414'.
+  """
+  return os.path.join(archiveDir, time.strftime('%Y%m%d%H', \
+      time.gmtime(hour * 3600)))
+
+def parseLine(line):
+  """
+  Split a line from ec_978.py into the parts we store.
+
+  Args:
+    line (str): Line from ec_978.py (any output format).
+
+  Returns:
+    tuple: ``None`` if not a FIS-B or ADS-B message, else a tuple
+    containing:
+
+    * Time (float). From the 't=' field, or now if there isn't one.
+    * Kind (``KIND_FISB`` or ``KIND_ADSB``).
+    * Key (int).
+    * Message bytes (trailing zeros removed for FIS-B).
+    * Trailer: the rest of the line (str), starting with ';' if not empty.
+  """
+  if (len(line) == 0) or (line[0] not in '+-'):
+    return None
+
+  hexStr, sep, trailer = line[1:].rstrip('\n').partition(';')
+
+  try:
+    data = bytes.fromhex(hexStr)
+  except ValueError:
+    return None
+
+  if line[0] == '+':
+    if len(data) != FISB_BYTES:
+      return None
+
+    kind = KIND_FISB
+    key = int.from_bytes(data[0:6], 'big')
+    data = data.rstrip(b'\0')
+  else:
+    if len(data) < 4:
+      return None
+
+    kind = KIND_ADSB
+    key = int.from_bytes(data[0:4], 'big') & 0x07ffffff
+
+  timeValue = None
+  for field in trailer.split(';'):
+    if field.startswith('t='):
+      try:
+        timeValue = float(field[2:])
+      except ValueError:
+        pass
+
+  if timeValue is None:
+    timeValue = time.time()
+
+  return timeValue, kind, key, data, sep + trailer
+
+def openSegment(archiveDir, hour):
+  """
+  Open (or continue) the segment for an hour.
+
+  Args:
+    archiveDir (str): Archive directory.
+    hour (int): Hours since the epoch.
+
+  Returns:
+    dict: Open segment with 'hour', the files 'seg', 'tix' and 'kix',
+    'count' (records written since opened), and 'maxTime' (latest
+    record time).
+  """
+  name = segmentName(archiveDir, hour)
+
+  return {'hour': hour, 'seg': open(name + '.seg', 'ab'), \
+      'tix': open(name + '.tix', 'ab'), 'kix': open(name + '.kix', 'ab'), \
+      'count': 0, 'maxTime': 0.0}
+
+def closeSegment(segment):
+  """
+  Close the files of a segment.
+
+  Args:
+    segment (dict): Segment from ``openSegment()``.
+  """
+  for x in ['seg', 'tix', 'kix']:
+    segment[x].close()
+
+def archiveRecord(segment, timeValue, kind, key, data, trailer):
+  """
+  Write a record and its index entries.
+
+  Args:
+    segment (dict): Segment from ``openSegment()``.
+    timeValue (float): Message time.
+    kind (int): ``KIND_FISB`` or ``KIND_ADSB``.
+    key (int): Key (see ``parseLine()``).
+    data (bytes): Message bytes.
+    trailer (str): Rest of the line.
+  """
+  offset = segment['seg'].tell()
+
+  if (segment['count'] > 0) and (segment['count'] % TIME_INDEX_EVERY == 0):
+    segment['tix'].write(struct.pack('<dQ', segment['maxTime'], offset))
+
+  trailerBytes = trailer.encode()
+  segment['seg'].write(RECORD_HEADER.pack(timeValue, key, kind, len(data), \
+      len(trailerBytes)) + data + trailerBytes)
+  segment['kix'].write(struct.pack('<QQ', (kind << 56) | key, offset))
+
+  segment['count'] += 1
+  segment['maxTime'] = max(segment['maxTime'], timeValue)
+
+  for x in ['seg', 'tix', 'kix']:
+    segment[x].flush()
+
+def mainArchive(archiveDir):
+  """
+  Archive lines from standard input until it ends. A new segment is
+  started when a message is from a later hour. Late messages from an
+  earlier hour go in the current segment (queries look there).
+
+  Args:
+    archiveDir (str): Archive directory.
+  """
+  os.makedirs(archiveDir, exist_ok=True)
+  segment = None
+
+  try:
+    for line in sys.stdin:
+      if tee:
+        print(line, end='', flush=True)
+
+      parts = parseLine(line)
+      if parts is None:
+        continue
+
+      hour = int(parts[0] // 3600)
+
+      if (segment is None) or (hour > segment['hour']):
+        if segment is not None:
+          closeSegment(segment)
+        segment = openSegment(archiveDir, hour)
+
+      archiveRecord(segment, *parts)
+
+  except KeyboardInterrupt:
+    pass
+
+  finally:
+    if segment is not None:
+      closeSegment(segment)
+
+def mapFile(path):
+  """
+  Memory map a file for reading.
+
+  Args:
+    path (str): File path.
+
+  Returns:
+    mmap: The mapped file, or ``None`` if it doesn't exist or is empty.
+  """
+  if (not os.path.isfile(path)) or (os.path.getsize(path) == 0):
+    return None
+
+  with open(path, 'rb') as f:
+    return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+def indexArray(mm, dtype):
+  """
+  Get the index entries in a mapped index file (ignoring any partly
+  written last entry).
+
+  Args:
+    mm (mmap): Mapped index file, or ``None``.
+    dtype (np.dtype): ``TIME_INDEX_DTYPE`` or ``KEY_INDEX_DTYPE``.
+
+  Returns:
+    nparray: Structured array of entries.
+  """
+  if mm is None:
+    return np.zeros(0, dtype)
+
+  return np.frombuffer(mm, dtype, count=len(mm) // dtype.itemsize)
+
+def readRecord(mm, offset):
+  """
+  Read a record and turn it back into its original line.
+
+  Args:
+    mm (mmap): Mapped segment file.
+    offset (int): Record offset.
+
+  Returns:
+    tuple: Time, key, kind, line, and the record length. ``None`` if the
+    record is not complete (still being written).
+  """
+  if offset + RECORD_HEADER.size > len(mm):
+    return None
+
+  timeValue, key, kind, dataLen, trailerLen = \
+      RECORD_HEADER.unpack_from(mm, offset)
+
+  dataStart = offset + RECORD_HEADER.size
+  if dataStart + dataLen + trailerLen > len(mm):
+    return None
+
+  data = mm[dataStart:dataStart + dataLen]
+  trailer = mm[dataStart + dataLen:dataStart + dataLen + trailerLen].decode()
+
+  if kind == KIND_FISB:
+    line = '+' + data.ljust(FISB_BYTES, b'\0').hex() + trailer
+  else:
+    line = '-' + data.hex() + trailer
+
+  return timeValue, key, kind, line, RECORD_HEADER.size + dataLen + trailerLen
+
+def querySegment(name, startTime, endTime, keyValue, keyMask):
+  """
+  Find the records in one segment that are in a time range and
+  (optionally) match a key.
+
+  Args:
+    name (str): Segment path without extension.
+    startTime (float): Start of range.
+    endTime (float): End of range.
+    keyValue (int): Key index value to match (kind in the top byte), or
+      ``None`` for all records.
+    keyMask (int): Mask applied to key index values before comparing.
+
+  Returns:
+    list: Lines of the matching records, in the order written.
+  """
+  segMm = mapFile(name + '.seg')
+  if segMm is None:
+    return []
+
+  # Start after the last index entry before the range.
+  tix = indexArray(mapFile(name + '.tix'), TIME_INDEX_DTYPE)
+  startOffset = 0
+  if len(tix) > 0:
+    i = np.searchsorted(np.maximum.accumulate(tix['maxTime']), startTime, \
+        side='left')
+    if i > 0:
+      startOffset = int(tix['offset'][i - 1])
+
+  if keyValue is None:
+    offsets = None
+  else:
+    kix = indexArray(mapFile(name + '.kix'), KEY_INDEX_DTYPE)
+    match = ((kix['key'] & np.uint64(keyMask)) == np.uint64(keyValue)) & \
+        (kix['offset'] >= np.uint64(startOffset))
+    offsets = iter(kix['offset'][match].tolist())
+
+  lines = []
+  offset = startOffset
+
+  while True:
+    if offsets is not None:
+      offset = next(offsets, None)
+      if offset is None:
+        break
+
+    record = readRecord(segMm, offset)
+    if record is None:
+      break
+
+    timeValue, _, _, line, length = record
+
+    if timeValue > endTime + LATE_SECS:
+      break
+
+    if startTime <= timeValue <= endTime:
+      lines.append(line)
+
+    offset += length
+
+  return lines
+
+def query(archiveDir, startTime, endTime, address = None, station = None):
+  """
+  Find archived messages in a time range, optionally for one ADS-B
+  address (any address qualifier) or FIS-B station.
+
+  Args:
+    archiveDir (str): Archive directory.
+    startTime (float): Start of range (epoch seconds).
+    endTime (float): End of range (epoch seconds).
+    address (int): ADS-B address, or ``None``.
+    station (int): First 6 bytes of FIS-B block 0, or ``None``.
+
+  Returns:
+    list: Lines as written by ec_978.py.
+  """
+  keyValue, keyMask = None, 0
+
+  if address is not None:
+    keyValue = (KIND_ADSB << 56) | address
+    keyMask = ~(0x07 << 24) & 0xffffffffffffffff
+  elif station is not None:
+    keyValue = (KIND_FISB << 56) | station
+    keyMask = 0xffffffffffffffff
+
+  # Late messages can be in the next hour's segment.
+  lines = []
+  for hour in range(int(startTime // 3600), int(endTime // 3600) + 2):
+    lines += querySegment(segmentName(archiveDir, hour), startTime, \
+        endTime, keyValue, keyMask)
+
+  return lines
+
+def parseTime(timeStr):
+  """
+  Parse a query time.
+
+  Args:
+    timeStr (str): Epoch seconds, or UTC time as 'YYYY-MM-DDTHH:MM' or
+      'YYYY-MM-DDTHH:MM:SS'.
+
+  Returns:
+    float: Epoch seconds.
+  """
+  try:
+    return float(timeStr)
+  except ValueError:
+    pass
+
+  for fmt in ['%Y-%m-%dT%H:%M:%S', '%Y-%m-%dT%H:%M']:
+    try:
+      return float(calendar.timegm(time.strptime(timeStr, fmt)))
+    except ValueError:
+      pass
+
+  raise ValueError(f'Bad time: {timeStr}')
+
+# Call main function
+if __name__ == "__main__":
+
+  hlpText = \
+    """archive_978.py: Archive and query decoded messages.
+
+Without query options, lines from 'ec_978.py' are read from standard
+input and kept in DIR in hourly segment files:
+
+    ./ec_978.py | ./archive_978.py --tee archive/ | ./server_978.py
+
+With query options, the archive is searched and matching lines are
+written to standard output as 'ec_978.py' wrote them:
+
+    ./archive_978.py archive/ --start 2022-03-04T14:00 \\
+        --end 2022-03-04T14:05 --addr A12345
+
+Messages are stored in binary (FIS-B without trailing zeros), so the
+archive is much smaller than the text. Each segment has a sparse time
+index and an index of ADS-B addresses and FIS-B stations, so queries
+read only what they need.
+
+tee
+===
+Also write the lines read to standard output, so 'archive_978.py' can
+sit in the middle of a pipeline.
+
+start, end
+==========
+Time range to find (UTC). Either epoch seconds or 'YYYY-MM-DDTHH:MM[:SS]'.
+Without '--start', the range starts at the beginning of the archive's
+first hour. Without '--end', it ends now.
+
+addr, station
+=============
+Only find ADS-B messages from this address (6 hex digits, any address
+qualifier), or FIS-B packets from this station (hex of the first 6 bytes
+of block 0, as shown by 'ec_978.py --report').
+"""
+  parser = argparse.ArgumentParser(description= hlpText, \
+          formatter_class=RawTextHelpFormatter)
+
+  parser.add_argument("dir", help='Archive directory.')
+
+  parser.add_argument("--tee", \
+    help='Also write lines to standard output.', action='store_true')
+  parser.add_argument("--start", required=False, \
+    help='Start of query time range.')
+  parser.add_argument("--end", required=False, \
+    help='End of query time range.')
+  parser.add_argument("--addr", required=False, \
+    help='Query ADS-B address (hex).')
+  parser.add_argument("--station", required=False, \
+    help='Query FIS-B station (hex of first 6 bytes of block 0).')
+
+  args = parser.parse_args()
+
+  if args.tee:
+    tee = True
+
+  if (args.start is None) and (args.end is None) and \
+      (args.addr is None) and (args.station is None):
+    mainArchive(args.dir)
+    sys.exit(0)
+
+  try:
+    if args.start is not None:
+      startTime = parseTime(args.start)
+    else:
+      # Start of the first segment.
+      names = sorted(glob.glob(os.path.join(args.dir, '*.seg')))
+      if len(names) == 0:
+        sys.exit(0)
+      startTime = float(calendar.timegm(time.strptime( \
+          os.path.basename(names[0])[0:10], '%Y%m%d%H')))
+
+    endTime = time.time()
+    if args.end is not None:
+      endTime = parseTime(args.end)
+
+    address = None
+    if args.addr is not None:
+      address = int(args.addr, 16)
+
+    station = None
+    if args.station is not None:
+      station = int(args.station, 16)
+  except ValueError as e:
+    print(f'archive_978.py: {e}', file=sys.stderr)
+    sys.exit(1)
+
+  for line in query(args.dir, startTime, endTime, address, station):
+    print(line)
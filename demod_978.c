@@ -50,7 +50,107 @@
  *      value. This works fine for real-time data, but when dumping a file,
  *      it won't work. The -x argument will make sure the times on the packet
  *      filename will sort correctly and make sense. Optional.</dd>
+ *
+ *  <dt>-n &lt;host:port&gt;</dt>
+ *      <dd>Read samples from an <em>rtl_tcp</em> server instead of standard
+ *      input. The frequency (978Mhz), sample rate (2083334) and gain
+ *      (see <code>-g</code>) are set using the rtl_tcp protocol. rtl_tcp
+ *      sends 8-bit unsigned samples (CU8), these are converted to CS16.
+ *      Optional.</dd>
+ *
+ *  <dt>-t &lt;host:port&gt;</dt>
+ *      <dd>Read samples from a plain TCP connection instead of standard
+ *      input. The sender must already be set to the correct frequency
+ *      and sample rate. Samples are CS16 unless <code>-u</code> is given.
+ *      Optional.</dd>
+ *
+ *  <dt>-u</dt>
+ *      <dd>Samples from <code>-t</code> are CU8 (8-bit unsigned) and not
+ *      CS16. Optional.</dd>
+ *
+ *  <dt>-g &lt;float&gt;</dt>
+ *      <dd>Tuner gain in dB for <code>-n</code>. If not given, the
+ *      rtl_tcp server is set to automatic gain. Optional.</dd>
+ *
+ *  <dt>-c &lt;port&gt;</dt>
+ *      <dd>Open a control socket on 127.0.0.1 at &lt;port&gt;. Settings
+ *      can be queried and changed while running, and statistics
+ *      displayed. See control_command() for the commands. Optional.</dd>
+ *
+ *  <dt>-b &lt;secs&gt;</dt>
+ *      <dd>Write a heartbeat frame every &lt;secs&gt; seconds, even when
+ *      no packets arrive. It carries the sequence number of the next
+ *      packet, sample and packet counts, and times. See
+ *      heartbeat_write(). Optional.</dd>
+ *
+ *  <dt>-F &lt;file&gt;</dt>
+ *      <dd>Write FIS-B packets to &lt;file&gt; and not standard output.
+ *      &lt;file&gt; can be a named pipe, or <code>/dev/fd/&lt;n&gt;</code>
+ *      for a file descriptor opened by the shell. Optional.</dd>
+ *
+ *  <dt>-A &lt;file&gt;</dt>
+ *      <dd>Write ADS-B packets to &lt;file&gt; and not standard output.
+ *      Like <code>-F</code>. Optional.</dd>
+ *
+ *  <dt>-T &lt;file&gt;</dt>
+ *      <dd>Tap. Also write every packet to &lt;file&gt;, for archiving or
+ *      a second decoder. A tap that falls behind misses packets rather
+ *      than slowing the other outputs. A named pipe gets packets once
+ *      something opens it for reading. Can be given up to
+ *      <code>OUTPUT_MAX_TAPS</code> times. Optional.</dd>
+ *
+ *  <dt>-s</dt>
+ *      <dd>Write ADS-B packets that are clearly short messages with only
+ *      the samples a short message needs (<code>ADSB_SHORT_WRITE_INTS</code>),
+ *      with a type of 'S'. See adsb_is_short(). Optional.</dd>
  * </dl>
+ *
+ * When reading from the network (<code>-n</code> or <code>-t</code>),
+ * a separate thread receives the samples into a large ring buffer. If
+ * the connection is lost it is retried every
+ * <code>NET_RECONNECT_SECS</code> seconds. Samples dropped because the
+ * ring was full, or lost while disconnected, are counted and reported
+ * on standard error.
+ *
+ * Packets are not written directly to standard output. They are placed
+ * on an output queue (<code>OUTPUT_QUEUE_SLOTS</code> packets) and written
+ * by a separate thread. If the program reading our output falls behind,
+ * we keep reading samples. When the queue is full, FIS-B packets are
+ * dropped before ADS-B packets, lowest signal level first. Drops are
+ * counted by type and reported on standard error. With <code>-x</code>
+ * nothing is dropped, we wait for the reader instead.
+ *
+ * With <code>-F</code> or <code>-A</code>, one pass over the samples
+ * feeds separate FIS-B and ADS-B outputs, so ADS-B packets don't wait
+ * behind 35KB FIS-B packets and each type can have its own
+ * <b>ec_978.py</b>. Each output has its own writer thread and can hold
+ * <code>OUTPUT_QUEUE_SLOTS</code> packets, so if one reader falls
+ * behind, only its own packets are dropped (in the usual order) while
+ * the other output keeps flowing.
+ *
+ * Packets are kept in a pool of reference counted buffers and queued on
+ * every output that writes them, so taps (<code>-T</code>) don't copy
+ * packets. Each tap can hold <code>TAP_QUEUE_SLOTS</code> packets of its
+ * own. When it is full it misses packets, so adding a tap never
+ * changes what the other outputs get.
+ *
+ * Eye statistics (signal levels, eye opening, sampling phase and zero
+ * crossing jitter) are kept for every packet and shown for the last
+ * <code>STATS_INTERVAL_SECS</code> seconds of samples by the control
+ * socket <code>stats</code> command. See eye_packet().
+ *
+ * So the SDR gain can be set without guessing, each block of raw
+ * samples is checked for full scale (clipped) values and the noise
+ * floor, and the power of each packet is kept. The <code>stats</code>
+ * command shows these and a suggested gain change. See adc_advice().
+ *
+ * Built with <code>-DFIXED_POINT</code> (<code>make demod_978_fixed</code>)
+ * for boards without a floating point unit, the signal power running
+ * total, RSSI, ADC power and packet times use only integer math. Logs
+ * come from a table (see log2_fixed()). Eye statistics are floating
+ * point in both builds, but are only kept when the control socket is
+ * open.
+ *
  * Data packets are sent to standard output preceeded with a 36 character
  * attribute string which has the following format:
  * <p>
@@ -62,7 +162,11 @@
  * <dt>&lt;usecs&gt;</dt>
  *  <dd>Microseconds associated with &lt;secs&gt;.</dd>
  * <dt>&lt;t&gt;</dt>
- *  <dd>'F' for FIS-B packet. 'A' for ADS-B packet (either long or short).</dd>
+ *  <dd>'F' for FIS-B packet. 'A' for ADS-B packet (either long or short).
+ *  'S' for an ADS-B packet that is clearly a short message
+ *  (<code>-s</code>), which has only <code>ADSB_SHORT_WRITE_INTS</code>
+ *  values. 'H' for a heartbeat frame (<code>-b</code>, see
+ *  heartbeat_write()).</dd>
  * <dt>&lt;level&gt;</dt>
  *  <dd>Absolute signal level. This is the raw signal level for the
  * sync code of the packet. In the -l argument, the level is
@@ -101,10 +205,20 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <sys/time.h>
 #include <time.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 /// Number of times a second we want to read data. This will affect 
 /// the size of the raw sample read buffer. (<code>10</code>)
@@ -124,6 +238,143 @@
 /// Size of raw_buf as int16. Just SAMPLE_BUFFER_BYTES / 2. (<code>416666</code>)
 #define SAMPLE_BUFFER_I16    (SAMPLE_BUFFER_BYTES / 2)
 
+/// Number of bytes in the network receive ring buffer. Holds about
+/// 4 seconds of CS16 samples. (<code>33554432</code>)
+#define NET_RING_BYTES        (1 << 25)
+
+/// Size of a single <code>recv()</code> from the network.
+/// (<code>65536</code>)
+#define NET_RECV_BYTES        65536
+
+/// Seconds to wait before trying to reconnect to a network
+/// sample source. (<code>2</code>)
+#define NET_RECONNECT_SECS    2
+
+/// Frequency to set rtl_tcp to. (<code>978000000</code>)
+#define RTLTCP_FREQUENCY      978000000
+
+/// rtl_tcp command: set center frequency.
+#define RTLTCP_CMD_FREQ       0x01
+
+/// rtl_tcp command: set sample rate.
+#define RTLTCP_CMD_RATE       0x02
+
+/// rtl_tcp command: set gain mode (0 = auto, 1 = manual).
+#define RTLTCP_CMD_GAIN_MODE  0x03
+
+/// rtl_tcp command: set tuner gain in tenths of a dB.
+#define RTLTCP_CMD_GAIN       0x04
+
+/// rtl_tcp command: set RTL2832 AGC (0 = off, 1 = on).
+#define RTLTCP_CMD_AGC        0x08
+
+/// Length of the header rtl_tcp sends when a client connects
+/// ("RTL0", tuner type, gain count). (<code>12</code>)
+#define RTLTCP_HEADER_LEN     12
+
+/// Maximum number of simultaneous control socket connections.
+/// (<code>4</code>)
+#define CONTROL_MAX_CLIENTS   4
+
+/// Longest control command line accepted. (<code>256</code>)
+#define CONTROL_LINE_LEN      256
+
+/// Size of the buffer used to build control socket replies.
+/// (<code>4096</code>)
+#define CONTROL_REPLY_LEN     4096
+
+/// Number of packets the output queue can hold. About 4.5MB.
+/// (<code>128</code>)
+#define OUTPUT_QUEUE_SLOTS    128
+
+/// Most taps (<code>-T</code>). (<code>4</code>)
+#define OUTPUT_MAX_TAPS       4
+
+/// Number of packets each tap can hold. A tap that falls further
+/// behind misses packets. (<code>32</code>)
+#define TAP_QUEUE_SLOTS       32
+
+/// Seconds between tries to open a tap that is a named pipe with no
+/// reader yet. (<code>1</code>)
+#define TAP_OPEN_RETRY_SECS   1
+
+/// Most seconds to wait at the end of input for taps to write what
+/// they have. (<code>2</code>)
+#define TAP_DRAIN_SECS        2
+
+/// Most live outputs: standard output, or <code>-F</code> and
+/// <code>-A</code>. (<code>2</code>)
+#define OUTPUT_MAX_LIVE       2
+
+/// Number of packet buffers. Enough for the live outputs and every
+/// tap to be full at once. Buffers are used most recently freed first,
+/// so the ones only needed with -F and -A are never touched without
+/// them.
+#define OUTPUT_POOL_SLOTS     ((OUTPUT_MAX_LIVE * OUTPUT_QUEUE_SLOTS) + \
+    (OUTPUT_MAX_TAPS * TAP_QUEUE_SLOTS))
+
+/// Minimum number of seconds between reports of output
+/// queue drops on standard error. (<code>10</code>)
+#define OUTPUT_REPORT_SECS    10
+
+/// Number of 64-bit values in a heartbeat frame (<code>-b</code>).
+/// See heartbeat_write(). (<code>8</code>)
+#define HEARTBEAT_VALUES      8
+
+/// Most outputs packets can be written to. Standard output, or
+/// separate FIS-B and ADS-B outputs (<code>-F</code> and <code>-A</code>),
+/// and the taps (<code>-T</code>).
+#define OUTPUT_MAX_CHANNELS   (2 + OUTPUT_MAX_TAPS)
+
+/// Seconds of samples in each set of eye and ADC statistics.
+/// (<code>60</code>)
+#define STATS_INTERVAL_SECS   60
+
+/// Number of buckets in the sampling phase histogram. Each covers
+/// 1/8 of a bit from -1/2 to +1/2. (<code>8</code>)
+#define EYE_PHASE_BUCKETS     8
+
+/// Number of FIS-B bits used for eye statistics. (<code>4416</code>)
+#define EYE_FISB_BITS         4416
+
+/// Number of ADS-B bits used for eye statistics. This is the length of
+/// a short message (the rest may not be data). (<code>240</code>)
+#define EYE_ADSB_BITS         240
+
+/// I or Q values this far from zero (either sign) are counted as full
+/// scale (clipped). 8-bit SDRs converted to CS16 reach 32640.
+/// (<code>32000</code>)
+#define ADC_CLIP_LEVEL        32000
+
+/// Number of complex samples in each piece of a block whose power is
+/// used to find the noise floor. (<code>1024</code>)
+#define ADC_CHUNK_SAMPLES     1024
+
+/// Number of 1 dB buckets in the power histograms, covering
+/// -100 dBFS to 0 dBFS. (<code>100</code>)
+#define ADC_DB_BUCKETS        100
+
+/// Percentile of chunk powers taken as the noise floor. Low enough to
+/// miss packets, high enough to miss a lucky quiet chunk.
+/// (<code>10</code>)
+#define ADC_NOISE_PERCENTILE  10
+
+/// Percentile of packet powers taken as the strong packets.
+/// (<code>95</code>)
+#define ADC_STRONG_PERCENTILE 95
+
+/// Strong packets should be about this level, leaving room for
+/// stronger ones. (<code>-10</code>)
+#define ADC_TARGET_DBFS       -10
+
+/// A noise floor below this is close to the ADC's own quantization
+/// noise, so weak packets are lost. (<code>-45</code>)
+#define ADC_NOISE_MIN_DBFS    -45
+
+/// Fraction of clipped samples at which gain is always reduced.
+/// (<code>0.0001</code>)
+#define ADC_CLIP_MAX_FRACTION 0.0001
+
 /// 36 bit valuefor syncing FIS-B. (<code>0x153225b1d</code>)
 #define SYNC_FISB             0x153225b1d
 
@@ -143,16 +394,66 @@
 /// (<code>771</code>)
 #define ADSB_WRITE_INTS       ((384 * 2) + 3)
 
+/// Number of bits in an ADS-B short message (144 + 96 parity).
+/// (<code>240</code>)
+#define ADSB_SHORT_BITS       240
+
+/// Number of bits in an ADS-B long message (272 + 112 parity).
+/// (<code>384</code>)
+#define ADSB_LONG_BITS        384
+
+/// Bits after a short message still written with it (<code>-s</code>),
+/// in case it is a little late. (<code>8</code>)
+#define ADSB_GUARD_BITS       8
+
+/// Number of int32 values to write with an ADS-B packet that is
+/// clearly a short message (<code>-s</code>).
+/// (<code>499</code>)
+#define ADSB_SHORT_WRITE_INTS (((ADSB_SHORT_BITS + ADSB_GUARD_BITS) * 2) + 3)
+
+/// A short message's payload type bits must each be at least the
+/// message's mean bit level divided by this. (<code>4</code>)
+#define ADSB_SHORT_MARGIN     4
+
+/// After a short message there is only noise. The mean level of the
+/// bits where a long message would go on must be below the message's
+/// mean bit level divided by this. (<code>2</code>)
+#define ADSB_SHORT_TAIL       2
+
 /// Each time sample represents 0.48 usecs. This is used to derive
 /// the time of arrival of packets. The actual FIS-B bit rate is 0.96 usecs.
 /// Since we sample at twice that, the sample rate is half of that, or
 /// 0.48 usecs. (<code>0.48</code>)
 #define SAMPLE_TIME_USECS     0.48
 
+/// <code>SAMPLE_TIME_USECS</code> in nanoseconds, for the fixed point
+/// build. (<code>480</code>)
+#define SAMPLE_TIME_NSECS     480
+
+/// Number of fraction bits in the logs made by log2_fixed() and
+/// db_fixed(). (<code>24</code>)
+#define LOG2_FRAC_BITS        24
+
+/// log2_fixed() looks up this many of the bits after the leading one
+/// bit and interpolates the rest. (<code>8</code>)
+#define LOG2_TABLE_BITS       8
+
+/// 10 * log10(2) (dB per doubling) with 28 fraction bits.
+/// (<code>808071242</code>)
+#define DB_PER_LOG2_Q28       808071242LL
+
+/// p_running_total_total at 0 dB RSSI in the fixed point build:
+/// 72 samples of magnitude 2^17 - 1 (see p_running_total()).
+#define RSSI_FULL_SCALE       (72ULL * 131071ULL * 131071ULL)
+
 /// This is the length of the attribute string that we send before
 /// every packet. (<code>36</code>)
 #define ATTRIBUTE_LEN         36
 
+/// Position of the packet type in the attribute string.
+/// (<code>18</code>)
+#define ATTRIBUTE_TYPE_POS    18
+
 /// running_total() keeps a record of the baseline signal level.
 /// We only check sync when the signal is higher than this value.
 /// This assumes lower values are basically random noise that passed the
@@ -176,6 +477,130 @@ bool doFisb = false;
 /// True if producing adsb packets (<code>-a</code>)
 bool doAdsb = false;
 
+/* Variables related to the control socket and statistics. */
+
+/// Port of the control socket (<code>-c</code>). 0 if not used.
+int controlPort = 0;
+
+/// Listening control socket, or -1.
+int controlListenFd = -1;
+
+/// Connected control clients. -1 if the slot is free.
+int controlClients[CONTROL_MAX_CLIENTS];
+
+/// Partial command line received from each control client.
+char controlLines[CONTROL_MAX_CLIENTS][CONTROL_LINE_LEN];
+
+/// Number of characters in each <code>controlLines</code> entry.
+int controlLineLens[CONTROL_MAX_CLIENTS];
+
+/// Number of FIS-B packets written. Changed with <code>output.lock</code>
+/// held, since heartbeat_write() reads it from the writer threads (a
+/// 64-bit value can't be read in one go on 32-bit boards).
+u_int64_t fisbPacketCount = 0;
+
+/// Number of ADS-B packets written. Changed with
+/// <code>output.lock</code> held, like <code>fisbPacketCount</code>.
+u_int64_t adsbPacketCount = 0;
+
+/// True if clearly short ADS-B messages are written short
+/// (<code>-s</code>).
+bool adsbShort = false;
+
+/// Number of ADS-B packets written short.
+u_int64_t adsbShortCount = 0;
+
+/// Number of complex samples read. Changed with
+/// <code>output.lock</code> held, like <code>fisbPacketCount</code>.
+u_int64_t samplesRead = 0;
+
+/// Time the last block of samples was read, in microseconds since
+/// epoch. Changed with <code>output.lock</code> held, like
+/// <code>fisbPacketCount</code>.
+u_int64_t lastReadUsecs = 0;
+
+/* Variables related to heartbeat frames. */
+
+/// Seconds between heartbeat frames (<code>-b</code>). 0 if not sent.
+int heartbeatSecs = 0;
+
+/* Variables related to separate FIS-B and ADS-B outputs. */
+
+/// File to write FIS-B packets to (<code>-F</code>). NULL for standard
+/// output.
+char *fisbOutputPath = NULL;
+
+/// File to write ADS-B packets to (<code>-A</code>). NULL for standard
+/// output.
+char *adsbOutputPath = NULL;
+
+/// Files to write a copy of every packet to (<code>-T</code>).
+char *tapPaths[OUTPUT_MAX_TAPS];
+
+/// Number of entries in <code>tapPaths</code>.
+int numTaps = 0;
+
+/* Variables related to network sample sources. */
+
+/// True if reading samples from the network (<code>-n</code> or
+/// <code>-t</code>) and not standard input.
+bool netSource = false;
+
+/// True if the network source is an rtl_tcp server (<code>-n</code>).
+bool netIsRtlTcp = false;
+
+/// True if the network samples are CU8 rather than CS16.
+/// Always true for rtl_tcp, set by <code>-u</code> for <code>-t</code>.
+bool netIsCu8 = false;
+
+/// Host name of the network source.
+char *netHost = NULL;
+
+/// Port (as a string) of the network source.
+char *netPort = NULL;
+
+/// Gain for rtl_tcp in tenths of a dB (<code>-g</code>). -1 is auto gain.
+int rtlTcpGain = -1;
+
+/// Maps a CU8 value to the CS16 value we would have gotten from
+/// an SDR program converting the same sample.
+int16_t cu8_to_cs16[256];
+
+/// Ring buffer filled by net_receive_thread() and emptied by
+/// read_block(). <code>head</code> and <code>tail</code> are byte counts
+/// since the start of the run (they never wrap), so the number
+/// of bytes available is always <code>head - tail</code>. Only whole
+/// CS16 complex samples (4 bytes) are ever added or dropped.
+struct {
+  /// Buffer holding CS16 samples.
+  char buf[NET_RING_BYTES];
+
+  /// Total bytes ever written to <code>buf</code>.
+  u_int64_t head;
+
+  /// Total bytes ever read from <code>buf</code>.
+  u_int64_t tail;
+
+  /// Time the byte at <code>head</code> arrived.
+  struct timeval lastArrival;
+
+  /// Complex samples thrown away because the ring was full.
+  u_int64_t droppedSamples;
+
+  /// Complex samples estimated lost while disconnected.
+  u_int64_t gapSamples;
+
+  /// Number of times we reconnected to the source.
+  u_int64_t reconnects;
+
+  /// Protects all of the above except <code>buf</code>.
+  pthread_mutex_t lock;
+
+  /// Signalled when new data is added.
+  pthread_cond_t dataReady;
+} net_ring = {.lock = PTHREAD_MUTEX_INITIALIZER,
+    .dataReady = PTHREAD_COND_INITIALIZER};
+
 /// Holds read buffer for complex data from SDR.
 /// We read the raw data as 4 bytes (two 16 bit ints representing a
 /// complex number), then process it as two 16 bit integers via
@@ -190,19 +615,145 @@ union {
   int16_t raw_buf_int [SAMPLE_BUFFER_I16];
 } raw;
 
-/// Holds write buffer for packets.
+/// One packet buffer of the output pool. Holds a packet waiting to be
+/// written by output_writer_thread() for each channel it is queued on.
 /// We process the data as int32s and write the data
 /// as 4 bytes. The size of the buffer holds a 
 /// FIS-B packet. ADS-B packets are smaller, thus fit inside too.
 /// Assumes little endian and a compiler like GCC which allows
 /// type-punning.
-union {
-  /// Holds output values as int32_t values. Part of union.
-  int32_t fisb_buf_ints [FISB_WRITE_INTS];
+typedef struct {
+  /// Attribute string (not NUL terminated when written).
+  char attributes[ATTRIBUTE_LEN + 1];
+
+  /// True if FIS-B packet, else ADS-B.
+  bool isFisb;
+
+  /// Live output channel the packet is written to.
+  int channel;
+
+  /// Number of channels (the live one and any taps) still to write the
+  /// packet. The slot is free when this reaches 0.
+  int refs;
+
+  /// Signal level of the packet. Used to pick what to drop.
+  u_int32_t level;
+
+  /// Number of bytes of <code>data</code> to write.
+  int bytesToWrite;
+
+  /// Packet samples.
+  union {
+    /// Holds output values as int32_t values. Part of union.
+    int32_t fisb_buf_ints [FISB_WRITE_INTS];
+
+    /// Holds output values as chars. Part of union.
+    char fisb_buf_bytes [FISB_WRITE_INTS * 4];
+  } data;
+} output_slot_t;
+
+/// One output packets are written to. Each has its own queue and
+/// output_writer_thread(), so a slow reader of one output doesn't hold
+/// up the others.
+typedef struct {
+  /// Channel number (index in <code>output.channels</code>).
+  int num;
+
+  /// True for a tap (<code>-T</code>). Taps get every packet the live
+  /// channels get, but only while they have room.
+  bool isTap;
+
+  /// Slot numbers waiting to be written, oldest first.
+  int queue[OUTPUT_QUEUE_SLOTS];
+
+  /// Number of entries in <code>queue</code>.
+  int queueLen;
+
+  /// Number of slots a live channel holds (queued or being written).
+  /// At most <code>OUTPUT_QUEUE_SLOTS</code>.
+  int held;
+
+  /// Packets a tap missed because it was full.
+  u_int64_t dropped;
+
+  /// True once a tap could not be written to (its reader went away).
+  /// It gets no more packets.
+  bool closed;
+
+  /// Buffered file written to. NULL for a tap that isn't open yet. Set
+  /// with <code>output.lock</code> held.
+  FILE *file;
+
+  /// Name shown in errors.
+  const char *name;
+
+  /// Number of packets written. This is the sequence number of the
+  /// next packet written.
+  u_int64_t written;
+
+  /// True while the writer is writing a slot it took off the queue.
+  bool writing;
+
+  /// Time the next heartbeat frame is due.
+  struct timespec heartbeatAt;
+} output_channel_t;
+
+/// Output queue. Packets are placed in a pool of reference counted
+/// slots by write_packet() and queued on each channel that will write
+/// them, so a packet is never copied however many channels there are.
+/// Each channel is written by its own output_writer_thread(), so a slow
+/// reader of our output never stops us reading samples. Each live
+/// channel can hold <code>OUTPUT_QUEUE_SLOTS</code> slots, so when a
+/// reader falls behind its packets fill them and the usual drop order
+/// applies to that channel only. Taps have their own slots in the pool.
+/// Slot <code>OUTPUT_POOL_SLOTS</code> is a scratch slot used to
+/// consume the samples of a packet we decided to drop.
+struct {
+  /// Packet buffers.
+  output_slot_t slots[OUTPUT_POOL_SLOTS + 1];
+
+  /// Number of packets queued on live channels.
+  int queueLen;
+
+  /// Slot numbers not in use.
+  int freeSlots[OUTPUT_POOL_SLOTS];
+
+  /// Number of entries in <code>freeSlots</code>.
+  int freeLen;
 
-  /// Holds output values as chars. Part of union.
-  char fisb_buf_bytes [FISB_WRITE_INTS * 4];
-} write_data;
+  /// Output channels. Channel 0 is standard output unless both
+  /// <code>-F</code> and <code>-A</code> are given.
+  output_channel_t channels[OUTPUT_MAX_CHANNELS];
+
+  /// Number of entries in <code>channels</code>.
+  int numChannels;
+
+  /// Channel FIS-B packets are written to.
+  int fisbChannel;
+
+  /// Channel ADS-B packets are written to.
+  int adsbChannel;
+
+  /// FIS-B packets dropped because the live channels were full.
+  u_int64_t droppedFisb;
+
+  /// ADS-B packets dropped because the live channels were full.
+  u_int64_t droppedAdsb;
+
+  /// Largest value <code>queueLen</code> has reached.
+  int maxQueueLen;
+
+  /// Protects everything except the contents of slots in use.
+  pthread_mutex_t lock;
+
+  /// Broadcast when a packet is queued.
+  pthread_cond_t packetReady;
+
+  /// Signalled when a slot is freed or a writer goes idle.
+  pthread_cond_t slotFree;
+} output = {.lock = PTHREAD_MUTEX_INITIALIZER,
+    .packetReady = PTHREAD_COND_INITIALIZER,
+    .slotFree = PTHREAD_COND_INITIALIZER};
 
 /// Holds the number of characters from the last
 /// read of 'raw'. Usually this is <code>SAMPLE_BUFFER_BYTES</code>,
@@ -215,198 +766,1853 @@ int raw_buf_int_size = 0;
 /// followed by a complex portion.
 int raw_buf_int_ptr = 0;
 
-/* Variables related to determing packet arrival times */
+/* Variables related to determing packet arrival times */
+
+/// This contains the number of 0.48 useconds intervals
+/// from the time a raw block was read. Used to compute
+/// time of packet arrival.
+int time_sample_ptr = 0;
+
+/// Set by read_block() at the time a new block is read.
+/// Used to compute the actual time of packet arrival.
+/// Contains the number of seconds since epoch.
+int64_t time_secs;
+
+/// Set by read_block() at the time a new block is read.
+/// Used to compute the actual time of packet arrival.
+/// Contains the number of useconds
+/// for the current second in <code>time_secs</code>.
+int64_t time_usecs;
+
+/// System time is read into this structure just before a
+/// raw block of data is read.
+struct timeval time_of_read;
+
+/* Variables related to the running total. */
+
+/// Current running total. Proxy for signal strength.
+/// See documentation for running_total() for details.
+u_int32_t current_running_total = 0;
+#ifndef FIXED_POINT
+double p_current_running_total = 0.0;
+#endif
+
+/// Array of last 72 samples for running total().
+/// 72 denotes 72 samples which is the length of
+/// 2 36-bit sync words.
+/// Only used by running_total().
+/// Could be static, but function is inline.
+int32_t running_total_samples[72] = {0};
+#ifdef FIXED_POINT
+u_int32_t p_running_total_samples[72] = {0};
+#else
+double p_running_total_samples[72] = {0.0};
+#endif
+
+/// Index into <code>running_total_samples</code>.
+/// Only used by running_total().
+/// Could be static, but function is inline.
+u_int8_t running_total_start = 0;
+u_int8_t p_running_total_start = 0;
+
+/// Total value of running_total not normalized.
+/// <code>current_running_total</code> is this value / 72
+/// (i.e. normalized).
+/// Only used by running_total().
+/// Could be static, but function is inline.
+u_int32_t running_total_total = 0;
+#ifdef FIXED_POINT
+u_int64_t p_running_total_total = 0;
+#else
+double p_running_total_total = 0;
+#endif
+
+/* Variables related to detecting sync codes. */
+
+/// Current 36-bit sync value for 'A' channel.
+/// Manipulated by check_sync().
+/// Global since function inline.
+u_int64_t syncA = 0;
+
+/// Current 36-bit sync value for 'B' channel.
+/// Manipulated by check_sync()
+/// Global since function inline.
+u_int64_t syncB = 0;
+
+/* Variables related to eye statistics. */
+
+/// Eye statistics added up over one interval. See eye_packet().
+typedef struct {
+  /// Number of packets.
+  u_int64_t packets;
+
+  /// Sum of each packet's eye opening.
+  double openingSum;
+
+  /// Sum of each packet's mean one level.
+  double oneLevelSum;
+
+  /// Sum of each packet's mean zero level (as a positive value).
+  double zeroLevelSum;
+
+  /// Sum of each packet's sampling phase in bits.
+  double phaseSum;
+
+  /// Number of zero crossings.
+  u_int64_t crossings;
+
+  /// Sum of the squares of zero crossing offsets from their packet's
+  /// sampling phase, in bits.
+  double crossingSumSq;
+
+  /// Packets by sampling phase.
+  u_int64_t phaseHist[EYE_PHASE_BUCKETS];
+} eye_stats_t;
+
+/// Eye statistics for the interval being collected and the last
+/// complete one. Only used by the main thread.
+struct {
+  /// Interval being collected.
+  eye_stats_t current;
+
+  /// Last complete interval.
+  eye_stats_t last;
+
+  /// True once <code>last</code> holds an interval.
+  bool haveLast;
+} eye;
+
+/// ADC statistics added up over one interval. See adc_block().
+typedef struct {
+  /// Number of complex samples.
+  u_int64_t samples;
+
+  /// Number of I or Q values at full scale.
+  u_int64_t clipped;
+
+  /// Number of chunks of <code>ADC_CHUNK_SAMPLES</code> by power in
+  /// dBFS (bucket 0 is -100 dBFS and below).
+  u_int32_t chunkHist[ADC_DB_BUCKETS];
+
+  /// Number of packets by power in dBFS at sync.
+  u_int32_t packetHist[ADC_DB_BUCKETS];
+
+  /// Number of packets.
+  u_int32_t packets;
+} adc_stats_t;
+
+/// ADC statistics for the interval being collected and the last
+/// complete one. Only used by the main thread.
+struct {
+  /// Interval being collected.
+  adc_stats_t current;
+
+  /// Last complete interval.
+  adc_stats_t last;
+
+  /// True once <code>last</code> holds an interval.
+  bool haveLast;
+} adc;
+
+/// Value of <code>samplesRead</code> when the current eye and ADC
+/// statistics intervals started.
+u_int64_t statsIntervalStart = 0;
+
+#ifdef FIXED_POINT
+/// log2(1 + i / 256) with <code>LOG2_FRAC_BITS</code> fraction bits,
+/// for log2_fixed().
+const u_int32_t log2Table[(1 << LOG2_TABLE_BITS) + 1] = {
+         0,    94364,   188362,   281996,   375270,   468185,
+    560745,   652952,   744810,   836320,   927485,  1018309,
+   1108793,  1198939,  1288752,  1378232,  1467383,  1556207,
+   1644705,  1732882,  1820738,  1908277,  1995500,  2082410,
+   2169009,  2255299,  2341283,  2426963,  2512340,  2597417,
+   2682196,  2766679,  2850868,  2934766,  3018374,  3101694,
+   3184728,  3267478,  3349946,  3432134,  3514044,  3595678,
+   3677038,  3758124,  3838941,  3919488,  3999768,  4079782,
+   4159533,  4239023,  4318251,  4397222,  4475935,  4554394,
+   4632599,  4710552,  4788255,  4865709,  4942916,  5019878,
+   5096595,  5173071,  5249305,  5325300,  5401057,  5476578,
+   5551864,  5626916,  5701737,  5776327,  5850688,  5924821,
+   5998727,  6072409,  6145867,  6219103,  6292118,  6364913,
+   6437490,  6509850,  6581994,  6653924,  6725641,  6797146,
+   6868440,  6939525,  7010402,  7081072,  7151536,  7221795,
+   7291852,  7361706,  7431359,  7500812,  7570066,  7639123,
+   7707984,  7776649,  7845119,  7913397,  7981483,  8049377,
+   8117082,  8184598,  8251926,  8319067,  8386022,  8452793,
+   8519380,  8585785,  8652008,  8718050,  8783912,  8849596,
+   8915102,  8980431,  9045584,  9110562,  9175366,  9239998,
+   9304457,  9368745,  9432863,  9496811,  9560591,  9624203,
+   9687648,  9750928,  9814042,  9876993,  9939780, 10002404,
+  10064867, 10127170, 10189312, 10251295, 10313120, 10374787,
+  10436298, 10497652, 10558852, 10619897, 10680789, 10741528,
+  10802114, 10862550, 10922835, 10982970, 11042956, 11102794,
+  11162484, 11222028, 11281425, 11340677, 11399784, 11458748,
+  11517568, 11576245, 11634780, 11693175, 11751428, 11809542,
+  11867517, 11925353, 11983051, 12040612, 12098037, 12155325,
+  12212479, 12269497, 12326382, 12383133, 12439752, 12496238,
+  12552593, 12608817, 12664911, 12720875, 12776710, 12832416,
+  12887994, 12943445, 12998770, 13053968, 13109041, 13163988,
+  13218811, 13273511, 13328087, 13382540, 13436871, 13491080,
+  13545168, 13599135, 13652983, 13706711, 13760320, 13813810,
+  13867183, 13920438, 13973576, 14026597, 14079503, 14132294,
+  14184969, 14237530, 14289978, 14342312, 14394532, 14446641,
+  14498638, 14550523, 14602297, 14653961, 14705514, 14756958,
+  14808293, 14859519, 14910637, 14961648, 15012551, 15063347,
+  15114037, 15164621, 15215099, 15265473, 15315742, 15365906,
+  15415967, 15465925, 15515779, 15565531, 15615181, 15664730,
+  15714177, 15763523, 15812769, 15861915, 15910962, 15959909,
+  16008758, 16057508, 16106160, 16154714, 16203172, 16251532,
+  16299796, 16347964, 16396036, 16444013, 16491896, 16539683,
+  16587377, 16634976, 16682482, 16729896, 16777216
+};
+
+/**
+ * @brief Base 2 log of an integer, using only integer math.
+ * 
+ * The position of the leading one bit is the whole part. The next
+ * <code>LOG2_TABLE_BITS</code> bits look up the fraction in
+ * <code>log2Table</code>, and the bits after that interpolate between
+ * table entries. The error is less than 3e-6.
+ * 
+ * @param x Value. 0 is taken as 1.
+ * @return int64_t log2(x) with <code>LOG2_FRAC_BITS</code> fraction bits.
+ */
+int64_t log2_fixed(u_int64_t x) {
+  if (x == 0)
+    x = 1;
+
+  int whole = 63 - __builtin_clzll(x);
+
+  // Leading one bit to the top, then the table index and the bits to
+  // interpolate with follow it.
+  u_int64_t m = x << (63 - whole);
+  int index = (m >> (63 - LOG2_TABLE_BITS)) & ((1 << LOG2_TABLE_BITS) - 1);
+  int64_t rest = (m >> (63 - LOG2_TABLE_BITS - LOG2_FRAC_BITS)) &
+      ((1 << LOG2_FRAC_BITS) - 1);
+
+  int64_t low = log2Table[index];
+  int64_t high = log2Table[index + 1];
+
+  return ((int64_t) whole << LOG2_FRAC_BITS) + low +
+      (((high - low) * rest) >> LOG2_FRAC_BITS);
+}
+
+/**
+ * @brief Power ratio in dB, using only integer math.
+ * 
+ * @param x Power.
+ * @param ref Power at 0 dB.
+ * @return int64_t <code>10 * log10(x / ref)</code> with
+ *   <code>LOG2_FRAC_BITS</code> fraction bits.
+ */
+int64_t db_fixed(u_int64_t x, u_int64_t ref) {
+  return ((log2_fixed(x) - log2_fixed(ref)) * DB_PER_LOG2_Q28) >> 28;
+}
+#endif
+
+/**
+ * @brief Update the running total of IQ power
+ * 
+ * power_running_total() keeps a running total of the last 72
+ * values of I^2 + Q^2 for future rssi calculation.
+ *
+ * For the last 72 values, we compute the average distance
+ * from the zero level. We do this by adding the absolute value
+ * of all samples then dividing by 72. Noise levels are usually
+ * quite low and actual signal is considerably higher.
+ * 
+ * This value is used by process_sample() to see if we need to
+ * check the sync.
+ * 
+ * @param new_sample Integer value of current sample.
+ * 
+ * Updates global: <code>running_total</code>.
+ */
+inline void p_running_total(int32_t realVal, int32_t imagVal) {
+#ifdef FIXED_POINT
+  // Unscaled power. The scaling below is done when it is turned into
+  // dB (see RSSI_FULL_SCALE). Fits in 32 bits for int16 samples.
+  u_int32_t power = (u_int32_t) (realVal * realVal) +
+      (u_int32_t) (imagVal * imagVal);
+
+  p_running_total_total = p_running_total_total -
+    p_running_total_samples[p_running_total_start] + power;
+  p_running_total_samples[p_running_total_start++] = power;
+
+  if (p_running_total_start == 72)
+    p_running_total_start = 0;
+#else
+  double r = (double) realVal;
+  double i = (double) imagVal;
+
+  // Convert to power (I^2 + Q^2)
+  // Uses dump978-fa formula but with 131071.0 (2^17 - 1) as the scaler.
+  // This produces RSSI values very similar to dump978-fa
+  double power = ((r*r) + (i*i)) / 131071.0 / 131071.0;
+  
+  // To make a fast running total, we keep all 72 values in
+  // an array. For each new value we add it to the total and
+  // the array and remove the earliest one.
+  p_running_total_total = p_running_total_total - 
+    p_running_total_samples[p_running_total_start] + power;
+  p_running_total_samples[p_running_total_start++] = power;
+
+  // Reset pointer to 0 if needed.
+  if (p_running_total_start == 72)
+    p_running_total_start = 0;
+
+  // Normalize running total and update global.
+  p_current_running_total = p_running_total_total / 72.0;
+#endif
+}
+
+/**
+ * @brief Update the current signal strength
+ * 
+ * running_total() keeps a running total of the absolute
+ * value for the last 72 demodulated values. This acts as
+ * a stand-in for signal strength.
+ * 
+ * For the last 72 values, we compute the average distance
+ * from the zero level. We do this by adding the absolute value
+ * of all samples then dividing by 72. Noise levels are usually
+ * quite low and actual signal is considerably higher.
+ * 
+ * This value is used by process_sample() to see if we need to
+ * check the sync.
+ * 
+ * @param new_sample Integer value of current sample.
+ * 
+ * Updates global: <code>running_total</code>.
+ */
+inline void running_total(int32_t new_sample) {
+  // Use absolute value of samples.
+  if (new_sample < 0)
+    new_sample = -new_sample;
+  
+  // To make a fast running total, we keep all 72 values in
+  // an array. For each new value we add it to the total and
+  // the array and remove the earliest one.
+  running_total_total = running_total_total - 
+    running_total_samples[running_total_start] + new_sample;
+  running_total_samples[running_total_start++] = new_sample;
+
+  // Reset pointer to 0 if needed.
+  if (running_total_start == 72)
+    running_total_start = 0;
+
+  // Normalize running total and update global.
+  current_running_total = running_total_total / 72;
+}
+
+/**
+ * @brief Check sync word for 4 or less errors.
+ *
+ * Uses Brian Kernighan's count 1-bits algorithm.
+ *  
+ * Note: One way to implement this and handle FIS-B
+ * and ADS-B at the same time would be to count all the one
+ * bits, and if the value is <= 4 you have a FIS-B value, and
+ * if the value is >= 32 then you have a valid ADS-B value.
+ * However, it is much faster to run each separately, since
+ * they are guaranteed not to exceed more than 4 loops each
+ * before exiting.
+ * 
+ * @param sync_val Current sync word.
+ * @param is_fisb  True if FIS-B check, else ADS-B check.
+ * @return True If this is a valid sync word, false otherwise.
+ * 
+ * Updates Globals: <code>last_sync_errors</code> (this is used only to put
+ * the number of sync errors in the output filename).
+ */
+inline bool check_sync(u_int64_t sync_val, bool is_fisb) {
+  u_int64_t xor_bits;
+  
+  // XOR to get a one bit for each bit that doesn't match
+  // the sync word.
+  if (is_fisb)
+    xor_bits = (sync_val & 0xFFFFFFFFF) ^ SYNC_FISB;
+  else
+    xor_bits = (sync_val & 0xFFFFFFFFF) ^ SYNC_ADSB;
+
+  int num_sync_errors = 0;
+
+  // Brian Kernighan's count 1-bits algorithm.
+  while (xor_bits != 0) {
+    xor_bits &= xor_bits - 1;
+    num_sync_errors++;
+
+    // exit if more than 4 errors (1-bits)
+    if (num_sync_errors > 4)
+      return false;
+  }
+
+  last_sync_errors = num_sync_errors;
+  return true;
+}
+
+/**
+ * @brief Add a packet to the eye statistics.
+ * 
+ * Bit centers are the odd samples (the first sample is the one before
+ * the packet) and the even samples fall between bits. For each bit
+ * center we add its value to the one or zero level. The eye opening is
+ * 1 - (sd(one) + sd(zero)) / (mean(one) + mean(zero)), so 1 is a
+ * perfect eye and 0 or less is closed.
+ * 
+ * Where two bits differ, the point the signal crosses zero is found by
+ * linear interpolation using the sample between them. With perfect
+ * timing it is exactly on that sample. The mean offset of the crossings
+ * is the packet's sampling phase (how far the bit centers are from
+ * where they should be), and the spread about that mean is the zero
+ * crossing jitter. Both are in bits.
+ * 
+ * Levels depend on signal strength, so each packet is summarized on its
+ * own and the summaries are added to <code>eye.current</code>.
+ * 
+ * @param samples Packet samples.
+ * @param numBits Number of bits to use.
+ */
+void eye_packet(int32_t *samples, int numBits) {
+  u_int32_t ones = 0, zeros = 0;
+  double oneSum = 0.0, oneSumSq = 0.0, zeroSum = 0.0, zeroSumSq = 0.0;
+  u_int32_t crossings = 0;
+  double crossSum = 0.0, crossSumSq = 0.0;
+
+  for (int i = 0; i < numBits; i++) {
+    double center = (double) samples[(i * 2) + 1];
+
+    if (center > 0) {
+      ones++;
+      oneSum += center;
+      oneSumSq += center * center;
+    } else {
+      zeros++;
+      zeroSum -= center;
+      zeroSumSq += center * center;
+    }
+
+    if (i == numBits - 1)
+      break;
+
+    // Look for a zero crossing between this bit and the next.
+    double next = (double) samples[(i * 2) + 3];
+    if ((center > 0) == (next > 0))
+      continue;
+
+    double mid = (double) samples[(i * 2) + 2];
+    double offset;
+
+    if ((center > 0) != (mid > 0))
+      offset = -0.5 + (0.5 * (center / (center - mid)));
+    else
+      offset = 0.5 * (mid / (mid - next));
+
+    crossings++;
+    crossSum += offset;
+    crossSumSq += offset * offset;
+  }
+
+  if ((ones < 2) || (zeros < 2) || (crossings == 0))
+    return;
+
+  double oneMean = oneSum / ones;
+  double zeroMean = zeroSum / zeros;
+  double oneSd = sqrt(fmax(0.0, (oneSumSq / ones) - (oneMean * oneMean)));
+  double zeroSd = sqrt(fmax(0.0, (zeroSumSq / zeros) - (zeroMean * zeroMean)));
+  double phase = crossSum / crossings;
+
+  eye.current.packets++;
+  eye.current.openingSum += 1.0 - ((oneSd + zeroSd) / (oneMean + zeroMean));
+  eye.current.oneLevelSum += oneMean;
+  eye.current.zeroLevelSum += zeroMean;
+  eye.current.phaseSum += phase;
+
+  // Jitter is measured about the packet's own phase, so a clock
+  // that is off doesn't show up as jitter.
+  eye.current.crossings += crossings;
+  eye.current.crossingSumSq += crossSumSq - (crossSum * phase);
+
+  int bucket = (int) ((phase + 0.5) * EYE_PHASE_BUCKETS);
+  if (bucket < 0)
+    bucket = 0;
+  else if (bucket >= EYE_PHASE_BUCKETS)
+    bucket = EYE_PHASE_BUCKETS - 1;
+
+  eye.current.phaseHist[bucket]++;
+}
+
+/**
+ * @brief Add eye statistics to a control reply.
+ * 
+ * Shows the last complete interval of <code>STATS_INTERVAL_SECS</code>
+ * seconds. Levels are in the same units as the packet samples, and
+ * phase and jitter are in bits.
+ * 
+ * @param buf Reply buffer.
+ * @param len Current length of the reply in <code>buf</code>.
+ * @param size Size of <code>buf</code>.
+ * @return int New length of the reply.
+ */
+int eye_format(char *buf, int len, int size) {
+  eye_stats_t *e = &eye.last;
+
+  if (!eye.haveLast || (e->packets == 0)) {
+    len += snprintf(buf + len, size - len, "eye_packets 0\n");
+    return len;
+  }
+
+  double jitter = sqrt(fmax(0.0, e->crossingSumSq / e->crossings));
+
+  len += snprintf(buf + len, size - len,
+      "eye_packets %" PRIu64 "\neye_opening %.3f\neye_one_level %.0f\n"
+      "eye_zero_level %.0f\neye_phase %+.3f\neye_jitter %.3f\n"
+      "eye_phase_hist", e->packets, e->openingSum / e->packets,
+      e->oneLevelSum / e->packets, e->zeroLevelSum / e->packets,
+      e->phaseSum / e->packets, jitter);
+
+  for (int i = 0; i < EYE_PHASE_BUCKETS; i++)
+    len += snprintf(buf + len, size - len, " %" PRIu64, e->phaseHist[i]);
+
+  len += snprintf(buf + len, size - len, "\n");
+  return len;
+}
+
+/**
+ * @brief Power in dBFS to an ADC histogram bucket.
+ * 
+ * @param dbfs Power in dBFS, rounded down.
+ * @return int Bucket number.
+ */
+int adc_bucket(int dbfs) {
+  int bucket = dbfs + ADC_DB_BUCKETS;
+
+  if (bucket < 0)
+    return 0;
+  if (bucket >= ADC_DB_BUCKETS)
+    return ADC_DB_BUCKETS - 1;
+  return bucket;
+}
+
+/**
+ * @brief Add a block of raw samples to the ADC statistics.
+ * 
+ * Counts full scale values and finds the power of each
+ * <code>ADC_CHUNK_SAMPLES</code> piece of the block. The inner loops are
+ * simple sums over the int16 values so the compiler can vectorize them.
+ * 0 dBFS is a complex sample with a magnitude of 32767.
+ * 
+ * @param samples Raw I/Q values.
+ * @param numInts Number of int16 values (twice the number of samples).
+ */
+void adc_block(int16_t *samples, int numInts) {
+  const int chunkInts = ADC_CHUNK_SAMPLES * 2;
+  u_int32_t clipped = 0;
+
+  for (int start = 0; start + chunkInts <= numInts; start += chunkInts) {
+    int64_t power = 0;
+
+    for (int i = start; i < start + chunkInts; i++) {
+      int32_t v = samples[i];
+      power += v * v;
+      clipped += ((v >= ADC_CLIP_LEVEL) | (v <= -ADC_CLIP_LEVEL));
+    }
+
+#ifdef FIXED_POINT
+    int64_t dbfs = db_fixed(power + 1,
+        ADC_CHUNK_SAMPLES * 32767ULL * 32767ULL);
+    adc.current.chunkHist[adc_bucket(dbfs >> LOG2_FRAC_BITS)]++;
+#else
+    double dbfs = 10.0 * log10(((double) power + 1.0) /
+        (ADC_CHUNK_SAMPLES * 32767.0 * 32767.0));
+    adc.current.chunkHist[adc_bucket((int) floor(dbfs))]++;
+#endif
+  }
+
+  adc.current.samples += numInts / 2;
+  adc.current.clipped += clipped;
+}
+
+/**
+ * @brief Add a packet's power at sync to the ADC statistics.
+ * 
+ * <code>p_current_running_total</code> is scaled for the RSSI
+ * (2^17 - 1 full scale), so it is changed to dBFS here.
+ */
+void adc_packet() {
+#ifdef FIXED_POINT
+  int64_t dbfs = db_fixed(p_running_total_total, 72ULL * 32767ULL * 32767ULL);
+  adc.current.packetHist[adc_bucket(dbfs >> LOG2_FRAC_BITS)]++;
+#else
+  double dbfs = (10.0 * log10(p_current_running_total + 1e-20)) +
+      (20.0 * log10(131071.0 / 32767.0));
+
+  adc.current.packetHist[adc_bucket((int) floor(dbfs))]++;
+#endif
+  adc.current.packets++;
+}
+
+/**
+ * @brief Find a percentile of an ADC power histogram.
+ * 
+ * @param hist Histogram of <code>ADC_DB_BUCKETS</code> buckets.
+ * @param total Total of all buckets (more than 0).
+ * @param percentile Percentile wanted (0 - 100).
+ * @return int Power in dBFS (the top of the bucket).
+ */
+int adc_percentile(u_int32_t *hist, u_int32_t total, int percentile) {
+  u_int64_t wanted = (((u_int64_t) total * percentile) + 99) / 100;
+  u_int64_t count = 0;
+
+  for (int i = 0; i < ADC_DB_BUCKETS; i++) {
+    count += hist[i];
+    if ((count >= wanted) && (count > 0))
+      return i + 1 - ADC_DB_BUCKETS;
+  }
+
+  return 0;
+}
+
+/**
+ * @brief Work out a gain change for the last ADC statistics interval.
+ * 
+ * In order:
+ * <ul>
+ *  <li>If more than <code>ADC_CLIP_MAX_FRACTION</code> of values are
+ *      clipped, reduce gain so strong packets are at
+ *      <code>ADC_TARGET_DBFS</code>, by at least 3 dB.</li>
+ *  <li>If strong packets are above <code>ADC_TARGET_DBFS</code>, reduce
+ *      gain to bring them there.</li>
+ *  <li>If the noise floor is below <code>ADC_NOISE_MIN_DBFS</code>,
+ *      increase gain to bring it there, but not so far that strong
+ *      packets go above <code>ADC_TARGET_DBFS</code>.</li>
+ * </ul>
+ * 
+ * With no packets, strong packets are taken to be at 2 *
+ * <code>ADC_TARGET_DBFS</code>, so gain goes up at most 10 dB at a time.
+ * 
+ * @param noiseDbfs Noise floor in dBFS.
+ * @param strongDbfs Strong packet power in dBFS, or 0 if there were
+ *   no packets.
+ * @param reason Set to a one word reason.
+ * @return int Gain change in dB. 0 if the gain is fine.
+ */
+int adc_advice(int noiseDbfs, int strongDbfs, const char **reason) {
+  adc_stats_t *a = &adc.last;
+  int headroom = (a->packets > 0) ? ADC_TARGET_DBFS - strongDbfs :
+      -ADC_TARGET_DBFS;
+
+  if (a->clipped > (a->samples * 2 * ADC_CLIP_MAX_FRACTION)) {
+    *reason = "clipping";
+    return (headroom < -3) ? headroom : -3;
+  }
+
+  if (headroom < 0) {
+    *reason = "strong";
+    return headroom;
+  }
+
+  if ((noiseDbfs < ADC_NOISE_MIN_DBFS) && (headroom > 0)) {
+    int change = ADC_NOISE_MIN_DBFS - noiseDbfs;
+    *reason = "weak";
+    return (change < headroom) ? change : headroom;
+  }
+
+  *reason = "ok";
+  return 0;
+}
+
+/**
+ * @brief Add ADC statistics and gain advice to a control reply.
+ * 
+ * Shows the last complete interval of <code>STATS_INTERVAL_SECS</code>
+ * seconds. Powers are in dBFS.
+ * 
+ * @param buf Reply buffer.
+ * @param len Current length of the reply in <code>buf</code>.
+ * @param size Size of <code>buf</code>.
+ * @return int New length of the reply.
+ */
+int adc_format(char *buf, int len, int size) {
+  adc_stats_t *a = &adc.last;
+  u_int32_t chunks = 0;
+
+  for (int i = 0; i < ADC_DB_BUCKETS; i++)
+    chunks += a->chunkHist[i];
+
+  if (!adc.haveLast || (chunks == 0))
+    return len;
+
+  int noiseDbfs = adc_percentile(a->chunkHist, chunks, ADC_NOISE_PERCENTILE);
+
+  len += snprintf(buf + len, size - len,
+      "adc_clipped %" PRIu64 "\nadc_clipped_pct %.4f\nadc_noise_dbfs %d\n",
+      a->clipped, (100.0 * a->clipped) / (a->samples * 2), noiseDbfs);
+
+  int strongDbfs = 0;
+  if (a->packets > 0) {
+    strongDbfs = adc_percentile(a->packetHist, a->packets,
+        ADC_STRONG_PERCENTILE);
+
+    len += snprintf(buf + len, size - len,
+        "adc_packet_dbfs_median %d\nadc_packet_dbfs_strong %d\n"
+        "adc_packet_dbfs_max %d\n",
+        adc_percentile(a->packetHist, a->packets, 50), strongDbfs,
+        adc_percentile(a->packetHist, a->packets, 100));
+  }
+
+  const char *reason;
+  int change = adc_advice(noiseDbfs, strongDbfs, &reason);
+
+  len += snprintf(buf + len, size - len, "gain_advice %+d %s\n", change,
+      reason);
+  return len;
+}
+
+/**
+ * @brief Start new eye and ADC statistics intervals if it is time.
+ * 
+ * Intervals are counted in samples, so they are the same length
+ * when reading a file (<code>-x</code>). Called from read_block(), so
+ * intervals end even when no packets arrive.
+ */
+void stats_interval_check() {
+  if ((samplesRead - statsIntervalStart) >=
+      ((u_int64_t) STATS_INTERVAL_SECS * SAMPLE_RATE)) {
+    eye.last = eye.current;
+    memset(&eye.current, 0, sizeof(eye.current));
+    eye.haveLast = true;
+
+    adc.last = adc.current;
+    memset(&adc.current, 0, sizeof(adc.current));
+    adc.haveLast = true;
+
+    statsIntervalStart = samplesRead;
+  }
+}
+
+/**
+ * @brief Check if a heartbeat frame is due.
+ * 
+ * @param channel Output channel.
+ * @return true If heartbeat frames are on (<code>-b</code>) and one is
+ *   due on <code>channel</code>.
+ */
+bool heartbeat_due(output_channel_t *channel) {
+  if (heartbeatSecs == 0)
+    return false;
+
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+
+  return (now.tv_sec > channel->heartbeatAt.tv_sec) ||
+      ((now.tv_sec == channel->heartbeatAt.tv_sec) &&
+      (now.tv_nsec >= channel->heartbeatAt.tv_nsec));
+}
+
+/**
+ * @brief Write a heartbeat frame to an output channel.
+ * 
+ * Heartbeat frames let the programs reading our output tell a quiet
+ * channel from a stopped demod_978, find packets lost between programs,
+ * and measure how far behind they are. Only called by
+ * output_writer_thread(), so it is never in the middle of a packet.
+ * 
+ * A heartbeat frame is an attribute string like a packet's, with a type
+ * of 'H' and the next packet sequence number (the last 8 digits) in
+ * place of the signal level:
+ * 
+ * <code>1638556942.209000.H.00012345.0.00000</code>
+ * 
+ * followed by <code>HEARTBEAT_VALUES</code> little-endian unsigned 64-bit
+ * values:
+ * <ol start="0">
+ *  <li>Sequence number of the next packet written to this channel.
+ *      Packets are numbered from 0 in the order written, so the reader
+ *      knows the number of every packet after a heartbeat.</li>
+ *  <li>Complex samples read.</li>
+ *  <li>FIS-B packets found.</li>
+ *  <li>ADS-B packets found.</li>
+ *  <li>FIS-B packets dropped by the output queue.</li>
+ *  <li>ADS-B packets dropped by the output queue.</li>
+ *  <li>Time the last block of samples was read (microseconds since
+ *      epoch). If this stops changing, the SDR has stopped.</li>
+ *  <li>Milliseconds between heartbeats.</li>
+ * </ol>
+ * 
+ * The time in the attribute string is when the heartbeat was sent. With
+ * separate FIS-B and ADS-B outputs, every output gets heartbeats. So do
+ * taps, but packets a tap missed are not counted in its sequence
+ * numbers.
+ * 
+ * @param channel Output channel.
+ * @return true If written. Only a tap can fail, for other channels we
+ *   exit.
+ */
+bool heartbeat_write(output_channel_t *channel) {
+  u_int64_t values[HEARTBEAT_VALUES];
+  char attributes[61];
+  struct timeval now;
+
+  gettimeofday(&now, NULL);
+
+  pthread_mutex_lock(&output.lock);
+  values[0] = channel->written;
+  values[1] = samplesRead;
+  values[2] = fisbPacketCount;
+  values[3] = adsbPacketCount;
+  values[4] = output.droppedFisb;
+  values[5] = output.droppedAdsb;
+  values[6] = lastReadUsecs;
+  pthread_mutex_unlock(&output.lock);
+
+  values[7] = (u_int64_t) heartbeatSecs * 1000;
+
+  sprintf(attributes, "%" PRIu64 ".%06ld.H.%08" PRIu64 ".0.00000",
+      (u_int64_t) now.tv_sec, (long) now.tv_usec, values[0] % 100000000);
+
+  if ((fwrite(attributes, 1, ATTRIBUTE_LEN, channel->file) !=
+      ATTRIBUTE_LEN) || (fwrite(values, sizeof(u_int64_t),
+      HEARTBEAT_VALUES, channel->file) != HEARTBEAT_VALUES) ||
+      (fflush(channel->file) != 0)) {
+    if (channel->isTap)
+      return false;
+
+    fprintf(stderr, "Error writing heartbeat to %s\n", channel->name);
+    exit(EXIT_FAILURE);
+  }
+
+  channel->heartbeatAt.tv_sec = now.tv_sec + heartbeatSecs;
+  channel->heartbeatAt.tv_nsec = (long) now.tv_usec * 1000;
+  return true;
+}
+
+/**
+ * @brief Take a channel's reference to a slot.
+ * 
+ * When no channel is left to write the packet, the slot goes back on
+ * the free list. Must be called with <code>output.lock</code> held.
+ * 
+ * @param channel Output channel.
+ * @param slotNum Slot number.
+ */
+void output_release(output_channel_t *channel, int slotNum) {
+  if (!channel->isTap)
+    channel->held--;
+
+  if (--output.slots[slotNum].refs == 0)
+    output.freeSlots[output.freeLen++] = slotNum;
+}
+
+/**
+ * @brief Close a tap that could not be written to.
+ * 
+ * Its queued packets are released and it gets no more, so the other
+ * outputs carry on. Ends the tap's writer thread.
+ * 
+ * @param channel Tap.
+ * @param slotNum Slot being written when it failed, or -1.
+ */
+void output_tap_failed(output_channel_t *channel, int slotNum) {
+  fprintf(stderr, "demod_978: cannot write to tap %s, closing it\n",
+      channel->name);
+
+  pthread_mutex_lock(&output.lock);
+  if (slotNum != -1)
+    output_release(channel, slotNum);
+
+  for (int i = 0; i < channel->queueLen; i++)
+    output_release(channel, channel->queue[i]);
+
+  channel->queueLen = 0;
+  channel->writing = false;
+  channel->closed = true;
+  pthread_cond_signal(&output.slotFree);
+  pthread_mutex_unlock(&output.lock);
+
+  if (channel->file != NULL)
+    fclose(channel->file);
+  pthread_exit(NULL);
+}
+
+/**
+ * @brief Try to open a tap's file without waiting for a reader.
+ * 
+ * Opening a named pipe for writing normally waits until something
+ * opens it for reading, which would stop us starting. It is opened
+ * non-blocking instead, which fails with <code>ENXIO</code> while there
+ * is no reader. Once open, only the tap's own writer thread waits on
+ * it, so it is made blocking again.
+ * 
+ * @param channel Tap.
+ * @return int 0 if open, <code>ENXIO</code> if the named pipe has no
+ *   reader yet, else the error.
+ */
+int output_tap_open(output_channel_t *channel) {
+  int fd = open(channel->name, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK,
+      0666);
+  if (fd == -1)
+    return errno;
+
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+
+  FILE *file = fdopen(fd, "wb");
+  if (file == NULL) {
+    int err = errno;
+    close(fd);
+    return err;
+  }
+
+  pthread_mutex_lock(&output.lock);
+  channel->file = file;
+  pthread_mutex_unlock(&output.lock);
+  return 0;
+}
+
+/**
+ * @brief Thread that writes queued packets to an output channel.
+ * 
+ * Takes the oldest packet off its channel's queue and writes it. The
+ * output is flushed whenever the channel's queue is empty so packets
+ * are not left sitting in the stdio buffer. Heartbeat frames
+ * (<code>-b</code>) are written between packets, and on time even if
+ * there are no packets. Never returns.
+ * 
+ * A tap that is a named pipe with no reader yet is opened here once it
+ * has one. Until then it gets no packets.
+ * 
+ * May terminate if errors detected during writing.
+ * 
+ * @param arg Output channel (<code>output_channel_t *</code>).
+ * @return void* Not used.
+ */
+void *output_writer_thread(void *arg) {
+  output_channel_t *channel = (output_channel_t *) arg;
+
+  while (channel->file == NULL) {
+    sleep(TAP_OPEN_RETRY_SECS);
+
+    int err = output_tap_open(channel);
+    if ((err != 0) && (err != ENXIO)) {
+      fprintf(stderr, "demod_978: cannot open tap %s: %s\n", channel->name,
+          strerror(err));
+      output_tap_failed(channel, -1);
+    }
+  }
+
+  while (1) {
+    pthread_mutex_lock(&output.lock);
+    while ((channel->queueLen == 0) && !heartbeat_due(channel)) {
+      if (heartbeatSecs == 0)
+        pthread_cond_wait(&output.packetReady, &output.lock);
+      else
+        pthread_cond_timedwait(&output.packetReady, &output.lock,
+            &channel->heartbeatAt);
+    }
+
+    if (heartbeat_due(channel)) {
+      pthread_mutex_unlock(&output.lock);
+      if (!heartbeat_write(channel))
+        output_tap_failed(channel, -1);
+      continue;
+    }
+
+    int slotNum = channel->queue[0];
+    channel->queueLen--;
+    memmove(&channel->queue[0], &channel->queue[1],
+        channel->queueLen * sizeof(int));
+    if (!channel->isTap)
+      output.queueLen--;
+    channel->writing = true;
+    pthread_mutex_unlock(&output.lock);
+
+    // Other channels may be writing the same slot. None of us change it.
+    output_slot_t *slot = &output.slots[slotNum];
+
+    // Write ATTRIBUTE_LEN bytes of attribute information
+    int attrBytesWritten = fwrite(slot->attributes, 1, ATTRIBUTE_LEN,
+        channel->file);
+    if ((attrBytesWritten != ATTRIBUTE_LEN) && channel->isTap)
+      output_tap_failed(channel, slotNum);
+
+    if (attrBytesWritten != ATTRIBUTE_LEN) {
+      fprintf(stderr, "Writing attribute, got %d for attribute length, not %d\n",
+          attrBytesWritten, ATTRIBUTE_LEN);
+      exit(EXIT_FAILURE);
+    }
+
+    // Write packet and make sure we wrote the correct number of bytes.
+    int bytes_written = fwrite(slot->data.fisb_buf_bytes, 1,
+        slot->bytesToWrite, channel->file);
+    if ((bytes_written != slot->bytesToWrite) && channel->isTap)
+      output_tap_failed(channel, slotNum);
+
+    if (bytes_written != slot->bytesToWrite) {
+      fprintf(stderr, "Got %d writing %s\n", bytes_written, channel->name);
+      exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&output.lock);
+    bool isEmpty = (channel->queueLen == 0);
+    pthread_mutex_unlock(&output.lock);
+
+    if (isEmpty && (fflush(channel->file) != 0)) {
+      if (channel->isTap)
+        output_tap_failed(channel, slotNum);
+
+      fprintf(stderr, "Error writing to %s\n", channel->name);
+      exit(EXIT_FAILURE);
+    }
+
+    pthread_mutex_lock(&output.lock);
+    output_release(channel, slotNum);
+    channel->written++;
+    channel->writing = false;
+    pthread_cond_signal(&output.slotFree);
+    pthread_mutex_unlock(&output.lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * @brief Open an output channel.
+ * 
+ * @param path File to write to (a named pipe, or something like
+ *   <code>/dev/fd/3</code>, works too). NULL for standard output.
+ * @param isTap True for a tap (<code>-T</code>).
+ * @return int Channel number.
+ */
+int output_open(const char *path, bool isTap) {
+  output_channel_t *channel = &output.channels[output.numChannels];
+
+  channel->num = output.numChannels++;
+  channel->isTap = isTap;
+
+  if (path == NULL) {
+    channel->name = "standard output";
+    channel->file = fdopen(dup(STDOUT_FILENO), "wb");
+  } else if (isTap) {
+    // A tap must never stop us. With no reader yet, its writer thread
+    // opens it later.
+    channel->name = path;
+    int err = output_tap_open(channel);
+    if (err == ENXIO)
+      return channel->num;
+
+    if (err != 0)
+      errno = err;
+  } else {
+    channel->name = path;
+    channel->file = fopen(path, "wb");
+  }
+
+  if (channel->file == NULL) {
+    fprintf(stderr, "Cannot open %s for output.\n", channel->name);
+    exit(EXIT_FAILURE);
+  }
+
+  return channel->num;
+}
+
+/**
+ * @brief Set up the output queues and start the writer threads.
+ * 
+ * Packets go to standard output unless <code>-F</code> or
+ * <code>-A</code> gave a separate file for FIS-B or ADS-B. Taps
+ * (<code>-T</code>) are opened after these.
+ */
+void output_init() {
+  for (int i = 0; i < OUTPUT_POOL_SLOTS; i++)
+    output.freeSlots[i] = i;
+
+  output.freeLen = OUTPUT_POOL_SLOTS;
+
+  if ((fisbOutputPath == NULL) || (adsbOutputPath == NULL)) {
+    output.fisbChannel = output_open(NULL, false);
+    output.adsbChannel = output.fisbChannel;
+  }
+
+  if (fisbOutputPath != NULL)
+    output.fisbChannel = output_open(fisbOutputPath, false);
+
+  if (adsbOutputPath != NULL)
+    output.adsbChannel = output_open(adsbOutputPath, false);
+
+  // A tap's reader going away must not kill us. Write errors close
+  // the tap instead (see output_tap_failed()).
+  if (numTaps > 0)
+    signal(SIGPIPE, SIG_IGN);
+
+  for (int i = 0; i < numTaps; i++)
+    output_open(tapPaths[i], true);
+
+  for (int i = 0; i < output.numChannels; i++) {
+    // First heartbeat goes out right away.
+    clock_gettime(CLOCK_REALTIME, &output.channels[i].heartbeatAt);
+
+    pthread_t writerThread;
+    if (pthread_create(&writerThread, NULL, output_writer_thread,
+        &output.channels[i]) != 0) {
+      fprintf(stderr, "Could not start output thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/**
+ * @brief Get a slot to hold a new packet.
+ * 
+ * Each live channel (not taps) can hold <code>OUTPUT_QUEUE_SLOTS</code>
+ * packets. If the channel the new packet goes to is full, the packet to
+ * drop is picked from that channel's queued packets and the new one,
+ * so a slow reader of one output never causes drops on another. FIS-B
+ * packets are dropped before ADS-B packets, and within a type, the
+ * lowest level packet is dropped. If the new packet is the one dropped,
+ * the scratch slot is returned so the samples can still be consumed.
+ * Drops are counted by type.
+ * 
+ * The pool has room for every live channel and tap to be full at once,
+ * so there is always a free slot once the channel is under its limit.
+ * Taps never cause a live packet to be dropped.
+ * 
+ * When reading from a file (<code>-x</code>) nothing is dropped by
+ * the live channels. We wait for them instead.
+ * 
+ * @param isFisb True if the new packet is FIS-B.
+ * @param level Signal level of the new packet.
+ * @return int Slot number to fill, then pass to output_queue_slot().
+ */
+int output_get_slot(bool isFisb, u_int32_t level) {
+  int slotNum;
+
+  output_channel_t *live =
+      &output.channels[isFisb ? output.fisbChannel : output.adsbChannel];
+
+  pthread_mutex_lock(&output.lock);
+
+  if (readingFromFile) {
+    while (live->held == OUTPUT_QUEUE_SLOTS)
+      pthread_cond_wait(&output.slotFree, &output.lock);
+  }
+
+  if (live->held < OUTPUT_QUEUE_SLOTS) {
+    slotNum = output.freeSlots[--output.freeLen];
+    pthread_mutex_unlock(&output.lock);
+    return slotNum;
+  }
+
+  // The channel is full. NULL means the new packet is the one to drop.
+  output_channel_t *victimChannel = NULL;
+  int victim = 0;
+  bool victimIsFisb = isFisb;
+  u_int32_t victimLevel = level;
+
+  for (int i = 0; i < live->queueLen; i++) {
+    output_slot_t *slot = &output.slots[live->queue[i]];
+
+    if ((slot->isFisb && !victimIsFisb) ||
+        ((slot->isFisb == victimIsFisb) && (slot->level < victimLevel))) {
+      victimChannel = live;
+      victim = i;
+      victimIsFisb = slot->isFisb;
+      victimLevel = slot->level;
+    }
+  }
+
+  if (victimIsFisb)
+    output.droppedFisb++;
+  else
+    output.droppedAdsb++;
+
+  if (victimChannel == NULL) {
+    slotNum = OUTPUT_POOL_SLOTS;
+  } else {
+    // Taps may still be writing the dropped packet, so take any free
+    // slot rather than reusing its one.
+    output_release(victimChannel, victimChannel->queue[victim]);
+    victimChannel->queueLen--;
+    memmove(&victimChannel->queue[victim], &victimChannel->queue[victim + 1],
+        (victimChannel->queueLen - victim) * sizeof(int));
+    output.queueLen--;
+
+    slotNum = output.freeSlots[--output.freeLen];
+  }
+
+  pthread_mutex_unlock(&output.lock);
+  return slotNum;
+}
+
+/**
+ * @brief Add a filled slot to the queue of its live channel and of
+ * every tap with room for it.
+ * 
+ * The slot is shared, not copied. Each channel holds a reference and
+ * the slot is freed when the last one has written it. A tap that is
+ * full misses the packet, which is counted as dropped by that tap.
+ * 
+ * @param slotNum Slot returned by output_get_slot(). If it is the
+ *   scratch slot, the packet is being dropped and nothing is queued.
+ */
+void output_queue_slot(int slotNum) {
+  if (slotNum == OUTPUT_POOL_SLOTS)
+    return;
+
+  output_slot_t *slot = &output.slots[slotNum];
+
+  pthread_mutex_lock(&output.lock);
+  output_channel_t *live = &output.channels[slot->channel];
+  live->queue[live->queueLen++] = slotNum;
+  slot->refs = 1;
+  live->held++;
+  output.queueLen++;
+  if (output.queueLen > output.maxQueueLen)
+    output.maxQueueLen = output.queueLen;
+
+  for (int c = 0; c < output.numChannels; c++) {
+    output_channel_t *tap = &output.channels[c];
+    if (!tap->isTap || tap->closed || (tap->file == NULL))
+      continue;
+
+    if ((tap->queueLen + (tap->writing ? 1 : 0)) < TAP_QUEUE_SLOTS) {
+      tap->queue[tap->queueLen++] = slotNum;
+      slot->refs++;
+    } else {
+      tap->dropped++;
+    }
+  }
+
+  pthread_cond_broadcast(&output.packetReady);
+  pthread_mutex_unlock(&output.lock);
+}
+
+/**
+ * @brief Check if any output channel has packets to write.
+ * 
+ * Must be called with <code>output.lock</code> held.
+ * 
+ * @param taps True to check taps, else live channels.
+ * @return true If a channel has queued packets or is writing one.
+ */
+bool output_busy(bool taps) {
+  for (int i = 0; i < output.numChannels; i++) {
+    if (output.channels[i].isTap != taps)
+      continue;
+
+    if ((output.channels[i].queueLen > 0) || output.channels[i].writing)
+      return true;
+  }
+
+  return false;
+}
+
+/**
+ * @brief Wait until all queued packets are written and flushed.
+ * 
+ * Called before exiting so no packets are lost at EOF. Taps get at
+ * most <code>TAP_DRAIN_SECS</code> seconds, so a tap whose reader has
+ * stopped reading can't keep us from exiting. Taps flush themselves
+ * when they have nothing queued.
+ */
+void output_drain() {
+  pthread_mutex_lock(&output.lock);
+  while (output_busy(false))
+    pthread_cond_wait(&output.slotFree, &output.lock);
+
+  struct timespec giveUpAt;
+  clock_gettime(CLOCK_REALTIME, &giveUpAt);
+  giveUpAt.tv_sec += TAP_DRAIN_SECS;
+
+  while (output_busy(true)) {
+    if (pthread_cond_timedwait(&output.slotFree, &output.lock,
+        &giveUpAt) == ETIMEDOUT)
+      break;
+  }
+  pthread_mutex_unlock(&output.lock);
+
+  for (int i = 0; i < output.numChannels; i++) {
+    if (!output.channels[i].isTap)
+      fflush(output.channels[i].file);
+  }
+
+  if ((output.droppedFisb + output.droppedAdsb) > 0) {
+    fprintf(stderr, "demod_978: output queue full, dropped FIS-B: %" PRIu64 ", "
+        "ADS-B: %" PRIu64 "\n", output.droppedFisb, output.droppedAdsb);
+  }
+
+  for (int i = 0; i < output.numChannels; i++) {
+    if (output.channels[i].dropped > 0) {
+      fprintf(stderr, "demod_978: tap %s full, dropped: %" PRIu64 "\n",
+          output.channels[i].name, output.channels[i].dropped);
+    }
+  }
+}
+
+/**
+ * @brief Open the control socket.
+ * 
+ * The socket only listens on 127.0.0.1. It is non-blocking and is
+ * serviced by control_poll() each time a block is read.
+ */
+void control_init() {
+  struct sockaddr_in addr;
+  int on = 1;
+
+  for (int i = 0; i < CONTROL_MAX_CLIENTS; i++)
+    controlClients[i] = -1;
+
+  controlListenFd = socket(AF_INET, SOCK_STREAM, 0);
+  if (controlListenFd == -1) {
+    fprintf(stderr, "Cannot create control socket.\n");
+    exit(EXIT_FAILURE);
+  }
+
+  setsockopt(controlListenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = htons(controlPort);
+
+  if ((bind(controlListenFd, (struct sockaddr *) &addr, sizeof(addr)) != 0) ||
+      (listen(controlListenFd, CONTROL_MAX_CLIENTS) != 0)) {
+    fprintf(stderr, "Cannot bind control socket to port %d.\n", controlPort);
+    exit(EXIT_FAILURE);
+  }
+
+  fcntl(controlListenFd, F_SETFL, O_NONBLOCK);
+}
+
+/**
+ * @brief Add current statistics to a control reply.
+ * 
+ * Each statistic is a line of the form <code>&lt;name&gt; &lt;value&gt;</code>.
+ * 
+ * @param buf Reply buffer.
+ * @param len Current length of the reply in <code>buf</code>.
+ * @param size Size of <code>buf</code>.
+ * @return int New length of the reply.
+ */
+int stats_format(char *buf, int len, int size) {
+  len += snprintf(buf + len, size - len,
+      "fisb_packets %" PRIu64 "\nadsb_packets %" PRIu64 "\n"
+      "samples %" PRIu64 "\n",
+      fisbPacketCount, adsbPacketCount, samplesRead);
+
+  if (adsbShort) {
+    len += snprintf(buf + len, size - len, "adsb_short_packets %" PRIu64 "\n",
+        adsbShortCount);
+  }
+
+  pthread_mutex_lock(&output.lock);
+  u_int64_t written = 0;
+  for (int i = 0; i < output.numChannels; i++) {
+    if (!output.channels[i].isTap)
+      written += output.channels[i].written;
+  }
+
+  len += snprintf(buf + len, size - len,
+      "queue_len %d\nqueue_max_len %d\nqueue_dropped_fisb %" PRIu64 "\n"
+      "queue_dropped_adsb %" PRIu64 "\nqueue_written %" PRIu64 "\n",
+      output.queueLen, output.maxQueueLen, output.droppedFisb, output.droppedAdsb, written);
+
+  // With separate outputs, show each so a stuck reader stands out.
+  if (output.fisbChannel != output.adsbChannel) {
+    len += snprintf(buf + len, size - len,
+        "queue_written_fisb %" PRIu64 "\nqueue_written_adsb %" PRIu64 "\n",
+        output.channels[output.fisbChannel].written,
+        output.channels[output.adsbChannel].written);
+  }
+
+  for (int i = 0, tap = 0; i < output.numChannels; i++) {
+    output_channel_t *channel = &output.channels[i];
+    if (!channel->isTap)
+      continue;
+
+    len += snprintf(buf + len, size - len,
+        "tap%d_len %d\ntap%d_written %" PRIu64 "\n"
+        "tap%d_dropped %" PRIu64 "\n", tap, channel->queueLen, tap,
+        channel->written, tap, channel->dropped);
+    tap++;
+  }
+  pthread_mutex_unlock(&output.lock);
+
+  if (netSource) {
+    pthread_mutex_lock(&net_ring.lock);
+    len += snprintf(buf + len, size - len,
+        "net_dropped %" PRIu64 "\nnet_gap %" PRIu64 "\n"
+        "net_reconnects %" PRIu64 "\n",
+        net_ring.droppedSamples, net_ring.gapSamples, net_ring.reconnects);
+    pthread_mutex_unlock(&net_ring.lock);
+  }
+
+  len = eye_format(buf, len, size);
+  len = adc_format(buf, len, size);
+
+  return len;
+}
+
+/**
+ * @brief Carry out a single control socket command.
+ * 
+ * Commands are single lines. Every reply ends with a line of
+ * <code>ok</code> or <code>error &lt;reason&gt;</code>. Commands:
+ * <dl>
+ *  <dt>get</dt><dd>Show current settings.</dd>
+ *  <dt>stats</dt><dd>Show packet and sample counts, eye and ADC
+ *      statistics, and gain advice.</dd>
+ *  <dt>set level &lt;float&gt;</dt><dd>Same as <code>-l</code>.</dd>
+ *  <dt>set mode fisb|adsb|both</dt><dd>Same as <code>-f</code>,
+ *      <code>-a</code>, or neither.</dd>
+ *  <dt>help</dt><dd>List commands.</dd>
+ * </dl>
+ * 
+ * @param fd Client socket to reply to.
+ * @param line Command line without the newline.
+ */
+void control_command(int fd, char *line) {
+  char reply[CONTROL_REPLY_LEN];
+  int len = 0;
+  char *cmd = strtok(line, " \t\r");
+  char *arg1 = strtok(NULL, " \t\r");
+  char *arg2 = strtok(NULL, " \t\r");
+  const char *err = NULL;
+
+  if (cmd == NULL) {
+    return;
+  } else if (strcmp(cmd, "get") == 0) {
+    len += snprintf(reply + len, sizeof(reply) - len,
+        "level %.6f\nmode %s\n", runningThreshold / 1000000.0,
+        (doFisb && doAdsb) ? "both" : (doFisb ? "fisb" : "adsb"));
+  } else if (strcmp(cmd, "stats") == 0) {
+    len = stats_format(reply, len, sizeof(reply));
+  } else if ((strcmp(cmd, "set") == 0) && (arg1 != NULL) && (arg2 != NULL)) {
+    if (strcmp(arg1, "level") == 0) {
+      // The whole argument must be a number. atof() would make a typo
+      // a level of 0, which lets noise through.
+      char *end;
+      double newLevel = strtod(arg2, &end);
+      if ((end == arg2) || (*end != '\0'))
+        err = "level must be a number";
+      else if (!(newLevel >= 0.0))
+        err = "level must be positive";
+      else if (newLevel >= (INT_MAX / 1000000.0))
+        err = "level too large";
+      else
+        runningThreshold = (int)(newLevel * 1000000.0);
+    } else if (strcmp(arg1, "mode") == 0) {
+      if (strcmp(arg2, "fisb") == 0) {
+        doFisb = true;
+        doAdsb = false;
+      } else if (strcmp(arg2, "adsb") == 0) {
+        doFisb = false;
+        doAdsb = true;
+      } else if (strcmp(arg2, "both") == 0) {
+        doFisb = true;
+        doAdsb = true;
+      } else {
+        err = "mode must be fisb, adsb or both";
+      }
+    } else {
+      err = "unknown setting";
+    }
+  } else if (strcmp(cmd, "help") == 0) {
+    len += snprintf(reply + len, sizeof(reply) - len,
+        "get\nstats\nset level <float>\nset mode fisb|adsb|both\n");
+  } else {
+    err = "unknown command";
+  }
+
+  if (err == NULL)
+    len += snprintf(reply + len, sizeof(reply) - len, "ok\n");
+  else
+    len += snprintf(reply + len, sizeof(reply) - len, "error %s\n", err);
+
+  if (len > sizeof(reply) - 1)
+    len = sizeof(reply) - 1;
+
+  send(fd, reply, len, MSG_NOSIGNAL);
+}
+
+/**
+ * @brief Service the control socket without blocking.
+ * 
+ * Accepts new connections, reads whatever is waiting from each
+ * client, and runs any complete command lines. Called from
+ * read_block(), so commands take effect between blocks.
+ */
+void control_poll() {
+  fd_set readFds;
+  struct timeval noWait = {0, 0};
+  int maxFd = controlListenFd;
+
+  FD_ZERO(&readFds);
+  FD_SET(controlListenFd, &readFds);
+  for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+    if (controlClients[i] != -1) {
+      FD_SET(controlClients[i], &readFds);
+      if (controlClients[i] > maxFd)
+        maxFd = controlClients[i];
+    }
+  }
+
+  if (select(maxFd + 1, &readFds, NULL, NULL, &noWait) <= 0)
+    return;
+
+  if (FD_ISSET(controlListenFd, &readFds)) {
+    int fd = accept(controlListenFd, NULL, NULL);
+    if (fd != -1) {
+      int slot;
+      for (slot = 0; slot < CONTROL_MAX_CLIENTS; slot++) {
+        if (controlClients[slot] == -1)
+          break;
+      }
+
+      if (slot == CONTROL_MAX_CLIENTS) {
+        close(fd);
+      } else {
+        controlClients[slot] = fd;
+        controlLineLens[slot] = 0;
+      }
+    }
+  }
+
+  for (int i = 0; i < CONTROL_MAX_CLIENTS; i++) {
+    int fd = controlClients[i];
+    if ((fd == -1) || !FD_ISSET(fd, &readFds))
+      continue;
+
+    char buf[CONTROL_LINE_LEN];
+    int n = recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+      close(fd);
+      controlClients[i] = -1;
+      continue;
+    }
+
+    for (int j = 0; j < n; j++) {
+      if (buf[j] == '\n') {
+        controlLines[i][controlLineLens[i]] = '\0';
+        control_command(fd, controlLines[i]);
+        controlLineLens[i] = 0;
+      } else if (controlLineLens[i] < CONTROL_LINE_LEN - 1) {
+        controlLines[i][controlLineLens[i]++] = buf[j];
+      }
+    }
+  }
+}
+
+/**
+ * @brief Connect to the network sample source.
+ * 
+ * @return int Socket, or -1 if the connection could not be made.
+ */
+int net_connect() {
+  struct addrinfo hints, *res, *rp;
+  int sock = -1;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
 
-/// This contains the number of 0.48 useconds intervals
-/// from the time a raw block was read. Used to compute
-/// time of packet arrival.
-int time_sample_ptr = 0;
+  if (getaddrinfo(netHost, netPort, &hints, &res) != 0) {
+    return -1;
+  }
 
-/// Set by read_block() at the time a new block is read.
-/// Used to compute the actual time of packet arrival.
-/// Contains the number of seconds since epoch.
-int64_t time_secs;
+  for (rp = res; rp != NULL; rp = rp->ai_next) {
+    sock = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    if (sock == -1)
+      continue;
 
-/// Set by read_block() at the time a new block is read.
-/// Used to compute the actual time of packet arrival.
-/// Contains the number of useconds
-/// for the current second in <code>time_secs</code>.
-int64_t time_usecs;
+    if (connect(sock, rp->ai_addr, rp->ai_addrlen) == 0)
+      break;
 
-/// System time is read into this structure just before a
-/// raw block of data is read.
-struct timeval time_of_read;
+    close(sock);
+    sock = -1;
+  }
 
-/* Variables related to the running total. */
+  freeaddrinfo(res);
+  return sock;
+}
 
-/// Current running total. Proxy for signal strength.
-/// See documentation for running_total() for details.
-u_int32_t current_running_total = 0;
-double p_current_running_total = 0.0;
+/**
+ * @brief Send a single rtl_tcp command.
+ * 
+ * Commands are 5 bytes: the command number followed by a
+ * 32-bit big-endian parameter.
+ * 
+ * @param sock Socket connected to rtl_tcp.
+ * @param cmd Command number (<code>RTLTCP_CMD_*</code>).
+ * @param param Parameter for the command.
+ * @return bool True if the command was sent.
+ */
+bool rtltcp_command(int sock, u_int8_t cmd, u_int32_t param) {
+  u_int8_t msg[5];
 
-/// Array of last 72 samples for running total().
-/// 72 denotes 72 samples which is the length of
-/// 2 36-bit sync words.
-/// Only used by running_total().
-/// Could be static, but function is inline.
-int32_t running_total_samples[72] = {0};
-double p_running_total_samples[72] = {0.0};
+  msg[0] = cmd;
+  msg[1] = (param >> 24) & 0xff;
+  msg[2] = (param >> 16) & 0xff;
+  msg[3] = (param >> 8) & 0xff;
+  msg[4] = param & 0xff;
 
-/// Index into <code>running_total_samples</code>.
-/// Only used by running_total().
-/// Could be static, but function is inline.
-u_int8_t running_total_start = 0;
-u_int8_t p_running_total_start = 0;
+  return send(sock, msg, 5, MSG_NOSIGNAL) == 5;
+}
 
-/// Total value of running_total not normalized.
-/// <code>current_running_total</code> is this value / 72
-/// (i.e. normalized).
-/// Only used by running_total().
-/// Could be static, but function is inline.
-u_int32_t running_total_total = 0;
-double p_running_total_total = 0;
+/**
+ * @brief Read the rtl_tcp header and set frequency, rate and gain.
+ * 
+ * @param sock Socket connected to rtl_tcp.
+ * @return bool True if the server is set up, false if the
+ *   connection should be dropped.
+ */
+bool rtltcp_setup(int sock) {
+  char header[RTLTCP_HEADER_LEN];
+  int got = 0;
+
+  // Header is "RTL0" followed by tuner type and number of gains.
+  while (got < RTLTCP_HEADER_LEN) {
+    int n = recv(sock, header + got, RTLTCP_HEADER_LEN - got, 0);
+    if (n <= 0)
+      return false;
+    got += n;
+  }
 
-/* Variables related to detecting sync codes. */
+  if (memcmp(header, "RTL0", 4) != 0) {
+    fprintf(stderr, "demod_978: %s:%s is not an rtl_tcp server\n",
+        netHost, netPort);
+    return false;
+  }
 
-/// Current 36-bit sync value for 'A' channel.
-/// Manipulated by check_sync().
-/// Global since function inline.
-u_int64_t syncA = 0;
+  if (!rtltcp_command(sock, RTLTCP_CMD_RATE, SAMPLE_RATE) ||
+      !rtltcp_command(sock, RTLTCP_CMD_FREQ, RTLTCP_FREQUENCY) ||
+      !rtltcp_command(sock, RTLTCP_CMD_AGC, 0))
+    return false;
 
-/// Current 36-bit sync value for 'B' channel.
-/// Manipulated by check_sync()
-/// Global since function inline.
-u_int64_t syncB = 0;
+  if (rtlTcpGain < 0)
+    return rtltcp_command(sock, RTLTCP_CMD_GAIN_MODE, 0);
 
-/// Filehandle for buffered stdout.
-FILE *stdoutbuf;
+  return rtltcp_command(sock, RTLTCP_CMD_GAIN_MODE, 1) &&
+      rtltcp_command(sock, RTLTCP_CMD_GAIN, rtlTcpGain);
+}
 
 /**
- * @brief Update the running total of IQ power
- * 
- * power_running_total() keeps a running total of the last 72
- * values of I^2 + Q^2 for future rssi calculation.
- *
- * For the last 72 values, we compute the average distance
- * from the zero level. We do this by adding the absolute value
- * of all samples then dividing by 72. Noise levels are usually
- * quite low and actual signal is considerably higher.
+ * @brief Add CS16 samples to the network ring buffer.
  * 
- * This value is used by process_sample() to see if we need to
- * check the sync.
- * 
- * @param new_sample Integer value of current sample.
+ * If there isn't room for all the samples, none of them are added
+ * and they are counted as dropped. This keeps the reader running
+ * on data that is contiguous except at the drop.
  * 
- * Updates global: <code>running_total</code>.
+ * @param data CS16 samples.
+ * @param len Number of bytes in <code>data</code>. Multiple of 4.
  */
-inline void p_running_total(int32_t realVal, int32_t imagVal) {
-  
-  double r = (double) realVal;
-  double i = (double) imagVal;
+void ring_write(const char *data, int len) {
+  pthread_mutex_lock(&net_ring.lock);
 
-  // Convert to power (I^2 + Q^2)
-  // Uses dump978-fa formula but with 131071.0 (2^17 - 1) as the scaler.
-  // This produces RSSI values very similar to dump978-fa
-  double power = ((r*r) + (i*i)) / 131071.0 / 131071.0;
-  
-  // To make a fast running total, we keep all 72 values in
-  // an array. For each new value we add it to the total and
-  // the array and remove the earliest one.
-  p_running_total_total = p_running_total_total - 
-    p_running_total_samples[p_running_total_start] + power;
-  p_running_total_samples[p_running_total_start++] = power;
+  if ((net_ring.head - net_ring.tail) + len > NET_RING_BYTES) {
+    net_ring.droppedSamples += len / 4;
+    pthread_mutex_unlock(&net_ring.lock);
+    return;
+  }
 
-  // Reset pointer to 0 if needed.
-  if (p_running_total_start == 72)
-    p_running_total_start = 0;
+  pthread_mutex_unlock(&net_ring.lock);
 
-  // Normalize running total and update global.
-  p_current_running_total = p_running_total_total / 72.0;
+  // Only this thread moves 'head', and the reader never reads
+  // past it, so the copy can be done without the lock.
+  int start = net_ring.head % NET_RING_BYTES;
+  int firstPart = NET_RING_BYTES - start;
+
+  if (firstPart >= len) {
+    memcpy(net_ring.buf + start, data, len);
+  } else {
+    memcpy(net_ring.buf + start, data, firstPart);
+    memcpy(net_ring.buf, data + firstPart, len - firstPart);
+  }
+
+  pthread_mutex_lock(&net_ring.lock);
+  net_ring.head += len;
+  gettimeofday(&net_ring.lastArrival, NULL);
+  pthread_cond_signal(&net_ring.dataReady);
+  pthread_mutex_unlock(&net_ring.lock);
 }
 
 /**
- * @brief Update the current signal strength
- * 
- * running_total() keeps a running total of the absolute
- * value for the last 72 demodulated values. This acts as
- * a stand-in for signal strength.
- * 
- * For the last 72 values, we compute the average distance
- * from the zero level. We do this by adding the absolute value
- * of all samples then dividing by 72. Noise levels are usually
- * quite low and actual signal is considerably higher.
+ * @brief Thread that receives samples from the network.
  * 
- * This value is used by process_sample() to see if we need to
- * check the sync.
+ * Connects (and reconnects) to the network source, converts CU8
+ * to CS16 if needed, and places whole complex samples in
+ * <code>net_ring</code>. Never returns.
  * 
- * @param new_sample Integer value of current sample.
+ * Time spent disconnected is converted to a number of samples
+ * and added to <code>net_ring.gapSamples</code>.
  * 
- * Updates global: <code>running_total</code>.
+ * @param arg Not used.
+ * @return void* Not used.
  */
-inline void running_total(int32_t new_sample) {
-  // Use absolute value of samples.
-  if (new_sample < 0)
-    new_sample = -new_sample;
-  
-  // To make a fast running total, we keep all 72 values in
-  // an array. For each new value we add it to the total and
-  // the array and remove the earliest one.
-  running_total_total = running_total_total - 
-    running_total_samples[running_total_start] + new_sample;
-  running_total_samples[running_total_start++] = new_sample;
+void *net_receive_thread(void *arg) {
+  static u_int8_t inBuf[NET_RECV_BYTES];
+  static int16_t outBuf[NET_RECV_BYTES];
 
-  // Reset pointer to 0 if needed.
-  if (running_total_start == 72)
-    running_total_start = 0;
+  // Bytes per complex sample of the source (2 for CU8, 4 for CS16).
+  int sampleBytes = netIsCu8 ? 2 : 4;
 
-  // Normalize running total and update global.
-  current_running_total = running_total_total / 72;
+  struct timeval lostAt;
+  bool everConnected = false;
+
+  while (1) {
+    int sock = net_connect();
+
+    if ((sock != -1) && netIsRtlTcp && !rtltcp_setup(sock)) {
+      close(sock);
+      sock = -1;
+    }
+
+    if (sock == -1) {
+      fprintf(stderr, "demod_978: cannot connect to %s:%s, retrying\n",
+          netHost, netPort);
+      sleep(NET_RECONNECT_SECS);
+      continue;
+    }
+
+    fprintf(stderr, "demod_978: connected to %s:%s\n", netHost, netPort);
+
+    // Bytes of a partial sample left over from the last recv().
+    int carry = 0;
+    bool firstData = true;
+
+    while (1) {
+      int n = recv(sock, inBuf + carry, NET_RECV_BYTES - carry, 0);
+      if (n <= 0) {
+        if ((n == -1) && (errno == EINTR))
+          continue;
+        break;
+      }
+
+      // Account for the time we were disconnected.
+      if (firstData) {
+        firstData = false;
+
+        if (everConnected) {
+          struct timeval now;
+          gettimeofday(&now, NULL);
+          double gapSecs = (now.tv_sec - lostAt.tv_sec) +
+              ((now.tv_usec - lostAt.tv_usec) / 1000000.0);
+
+          pthread_mutex_lock(&net_ring.lock);
+          net_ring.gapSamples += (u_int64_t) (gapSecs * SAMPLE_RATE);
+          net_ring.reconnects++;
+          pthread_mutex_unlock(&net_ring.lock);
+        }
+        everConnected = true;
+      }
+
+      n += carry;
+      int whole = n - (n % sampleBytes);
+
+      if (netIsCu8) {
+        for (int i = 0; i < whole; i++)
+          outBuf[i] = cu8_to_cs16[inBuf[i]];
+
+        ring_write((char *) outBuf, whole * 2);
+      } else {
+        ring_write((char *) inBuf, whole);
+      }
+
+      // Keep any partial sample for next time.
+      carry = n - whole;
+      if (carry > 0)
+        memmove(inBuf, inBuf + whole, carry);
+    }
+
+    close(sock);
+    gettimeofday(&lostAt, NULL);
+    fprintf(stderr, "demod_978: lost connection to %s:%s\n",
+        netHost, netPort);
+    sleep(NET_RECONNECT_SECS);
+  }
+
+  return NULL;
 }
 
 /**
- * @brief Check sync word for 4 or less errors.
- *
- * Uses Brian Kernighan's count 1-bits algorithm.
- *  
- * Note: One way to implement this and handle FIS-B
- * and ADS-B at the same time would be to count all the one
- * bits, and if the value is <= 4 you have a FIS-B value, and
- * if the value is >= 32 then you have a valid ADS-B value.
- * However, it is much faster to run each separately, since
- * they are guaranteed not to exceed more than 4 loops each
- * before exiting.
+ * @brief Read a block of raw data from the network ring buffer.
  * 
- * @param sync_val Current sync word.
- * @param is_fisb  True if FIS-B check, else ADS-B check.
- * @return True If this is a valid sync word, false otherwise.
+ * Waits until a whole block is available. The time of read is the
+ * arrival time of the newest data less the time represented by
+ * the data still waiting in the ring. Any new dropped or lost
+ * samples are reported on standard error.
  * 
- * Updates Globals: <code>last_sync_errors</code> (this is used only to put
- * the number of sync errors in the output filename).
+ * Update globals: <code>time_of_read</code>,
+ * <code>raw_buf_int_size</code>.
  */
-inline bool check_sync(u_int64_t sync_val, bool is_fisb) {
-  u_int64_t xor_bits;
-  
-  // XOR to get a one bit for each bit that doesn't match
-  // the sync word.
-  if (is_fisb)
-    xor_bits = (sync_val & 0xFFFFFFFFF) ^ SYNC_FISB;
-  else
-    xor_bits = (sync_val & 0xFFFFFFFFF) ^ SYNC_ADSB;
+void read_block_net() {
+  static u_int64_t reportedDropped = 0;
+  static u_int64_t reportedGap = 0;
+
+  pthread_mutex_lock(&net_ring.lock);
+  while ((net_ring.head - net_ring.tail) < SAMPLE_BUFFER_BYTES) {
+    // Wake up every 1/READS_PER_SECOND of a second so the control
+    // socket still works when the source has stalled.
+    struct timespec wakeAt;
+    clock_gettime(CLOCK_REALTIME, &wakeAt);
+    wakeAt.tv_nsec += 1000000000 / READS_PER_SECOND;
+    if (wakeAt.tv_nsec >= 1000000000) {
+      wakeAt.tv_sec++;
+      wakeAt.tv_nsec -= 1000000000;
+    }
 
-  int num_sync_errors = 0;
+    if ((pthread_cond_timedwait(&net_ring.dataReady, &net_ring.lock,
+        &wakeAt) == ETIMEDOUT) && (controlListenFd != -1)) {
+      pthread_mutex_unlock(&net_ring.lock);
+      control_poll();
+      pthread_mutex_lock(&net_ring.lock);
+    }
+  }
 
-  // Brian Kernighan's count 1-bits algorithm.
-  while (xor_bits != 0) {
-    xor_bits &= xor_bits - 1;
-    num_sync_errors++;
+  u_int64_t waiting = net_ring.head - net_ring.tail;
+  struct timeval arrival = net_ring.lastArrival;
+  u_int64_t dropped = net_ring.droppedSamples;
+  u_int64_t gap = net_ring.gapSamples;
+  u_int64_t reconnects = net_ring.reconnects;
+  pthread_mutex_unlock(&net_ring.lock);
+
+  // Time the first sample of this block arrived. Each complex sample
+  // (4 bytes) is SAMPLE_TIME_USECS.
+#ifdef FIXED_POINT
+  int64_t usecsBack = (int64_t) (((waiting / 4) * SAMPLE_TIME_NSECS) / 1000);
+#else
+  int64_t usecsBack = (int64_t) ((waiting / 4) * SAMPLE_TIME_USECS);
+#endif
+  int64_t usecs = ((int64_t) arrival.tv_sec * 1000000) +
+      arrival.tv_usec - usecsBack;
+  time_of_read.tv_sec = usecs / 1000000;
+  time_of_read.tv_usec = usecs % 1000000;
+
+  // Writer never touches bytes between 'tail' and 'head'.
+  int start = net_ring.tail % NET_RING_BYTES;
+  int firstPart = NET_RING_BYTES - start;
+
+  if (firstPart >= SAMPLE_BUFFER_BYTES) {
+    memcpy(raw.raw_buf_bytes, net_ring.buf + start, SAMPLE_BUFFER_BYTES);
+  } else {
+    memcpy(raw.raw_buf_bytes, net_ring.buf + start, firstPart);
+    memcpy(raw.raw_buf_bytes + firstPart, net_ring.buf,
+        SAMPLE_BUFFER_BYTES - firstPart);
+  }
 
-    // exit if more than 4 errors (1-bits)
-    if (num_sync_errors > 4)
-      return false;
+  pthread_mutex_lock(&net_ring.lock);
+  net_ring.tail += SAMPLE_BUFFER_BYTES;
+  pthread_mutex_unlock(&net_ring.lock);
+
+  if ((dropped != reportedDropped) || (gap != reportedGap)) {
+    fprintf(stderr, "demod_978: samples dropped (ring full): %" PRIu64 ", "
+        "lost (disconnected): %" PRIu64 ", reconnects: %" PRIu64 "\n",
+        dropped, gap, reconnects);
+    reportedDropped = dropped;
+    reportedGap = gap;
   }
 
-  last_sync_errors = num_sync_errors;
-  return true;
+  raw_buf_int_size = SAMPLE_BUFFER_BYTES;
 }
 
 /**
@@ -414,36 +2620,75 @@ inline bool check_sync(u_int64_t sync_val, bool is_fisb) {
  * 
  * Will exit for EOF or errors. Also, stores the time of read so
  * that it can be used to compute actual packet arrival time.
+ * If reading from the network, read_block_net() supplies the data
+ * instead.
  * 
  * Update globals: <code>time_secs</code>, <code>time_usecs</code>,
  * <code>raw_buf_int_size</code>, <code>raw_buf_int_ptr</code>.
  */
 void read_block() {
+  if (netSource) {
+    read_block_net();
+  } else {
     // Get current time and store away. This is used later to compute
     // packet arrival times.
     gettimeofday(&time_of_read, NULL);
-    time_secs = (int64_t) time_of_read.tv_sec;
-    time_usecs = (int64_t) time_of_read.tv_usec;
 
     // Read block of data from standard input.
     raw_buf_int_size = read(STDIN_FILENO, raw.raw_buf_bytes,
           SAMPLE_BUFFER_BYTES);
     switch (raw_buf_int_size) {
       case 0:
-        // EOF, just exit
+        // EOF, write anything still queued and exit
         close(STDIN_FILENO);
+        output_drain();
         exit(EXIT_SUCCESS);
       case -1:
         // Error, print error message and exit
         fprintf(stdout, "Error occurred reading file\n");
         exit(EXIT_FAILURE);
     }
+  }
+
+  time_secs = (int64_t) time_of_read.tv_sec;
+  time_usecs = (int64_t) time_of_read.tv_usec;
+
+  // Size returned was number of bytes, make that the number of int16s.
+  raw_buf_int_size /= 2;
+
+  pthread_mutex_lock(&output.lock);
+  lastReadUsecs = ((u_int64_t) time_secs * 1000000) + time_usecs;
+  samplesRead += raw_buf_int_size / 2;
+  pthread_mutex_unlock(&output.lock);
+
+  adc_block(raw.raw_buf_int, raw_buf_int_size);
+  stats_interval_check();
+
+  // Block boundaries are a good time to handle control commands.
+  if (controlListenFd != -1)
+    control_poll();
 
-    // Size returned was number of bytes, make that the number of int16s.
-    raw_buf_int_size /= 2;
+  // Let the user know if the output queue is dropping packets. At
+  // most every OUTPUT_REPORT_SECS seconds.
+  static u_int64_t reportedDrops = 0;
+  static int64_t lastDropReport = 0;
 
-    // reset pointer
-    raw_buf_int_ptr = 0;
+  if ((time_secs - lastDropReport) >= OUTPUT_REPORT_SECS) {
+    pthread_mutex_lock(&output.lock);
+    u_int64_t droppedFisb = output.droppedFisb;
+    u_int64_t droppedAdsb = output.droppedAdsb;
+    pthread_mutex_unlock(&output.lock);
+
+    if ((droppedFisb + droppedAdsb) != reportedDrops) {
+      fprintf(stderr, "demod_978: output queue full, dropped FIS-B: %"
+          PRIu64 ", ADS-B: %" PRIu64 "\n", droppedFisb, droppedAdsb);
+      reportedDrops = droppedFisb + droppedAdsb;
+      lastDropReport = time_secs;
+    }
+  }
+
+  // reset pointer
+  raw_buf_int_ptr = 0;
 }
 
 /**
@@ -536,6 +2781,51 @@ int32_t demod_one() {
   return sample;
 }
 
+/**
+ * @brief Check if an ADS-B packet is clearly a short message.
+ * 
+ * Short messages have a payload type code (first 5 bits) of 0 (or 12,
+ * like ec_978.py). It must not be a near thing: each of the 5 bits has
+ * to be at least <code>ADSB_SHORT_MARGIN</code> of the mean bit level
+ * of the first <code>ADSB_SHORT_BITS</code>. As a check, the rest of a
+ * long message's bits (after the guard bits) must be mostly noise
+ * (<code>ADSB_SHORT_TAIL</code>). Anything else might be long and is
+ * sent whole.
+ * 
+ * @param samples Packet samples. Bit centers are the odd samples.
+ * @return true If the packet can be sent short.
+ */
+bool adsb_is_short(int32_t *samples) {
+  // Levels are kept as sums, so the tests multiply instead of dividing.
+  int64_t payloadSum = 0;
+  for (int i = 0; i < ADSB_SHORT_BITS; i++)
+    payloadSum += abs(samples[(i * 2) + 1]);
+
+  if (payloadSum == 0)
+    return false;
+
+  int typeCode = 0;
+  for (int i = 0; i < 5; i++) {
+    int32_t bit = samples[(i * 2) + 1];
+
+    if (((int64_t) abs(bit) * ADSB_SHORT_MARGIN * ADSB_SHORT_BITS) <
+        payloadSum)
+      return false;
+
+    typeCode = (typeCode << 1) | (bit > 0 ? 1 : 0);
+  }
+
+  if ((typeCode != 0) && (typeCode != 12))
+    return false;
+
+  int64_t tailSum = 0;
+  for (int i = ADSB_SHORT_BITS + ADSB_GUARD_BITS; i < ADSB_LONG_BITS; i++)
+    tailSum += abs(samples[(i * 2) + 1]);
+
+  return (tailSum * ADSB_SHORT_TAIL * ADSB_SHORT_BITS) <
+      (payloadSum * (ADSB_LONG_BITS - ADSB_SHORT_BITS - ADSB_GUARD_BITS));
+}
+
 /**
  * @brief Write demodulated packet (without sync) to standard output.
  * 
@@ -546,7 +2836,12 @@ int32_t demod_one() {
  * and two after. This lets the final decode program calculate
  * the next shifted sample, and determine optimum sampling points.
  * 
- * May terminate if errors detected during writing.
+ * The packet is placed on the output queue and actually written by
+ * output_writer_thread().
+ * 
+ * All the samples of a long ADS-B message are always read, so finding
+ * packets doesn't change with <code>-s</code>. Only what is written
+ * does.
  * 
  * @param isFisb True if FIS-B packet, else ADS-B packet.
  */
@@ -568,8 +2863,13 @@ void write_packet(bool isFisb) {
     }
   }
   else {
+#ifdef FIXED_POINT
+    usecs_after_sample = (((int64_t) time_sample_ptr - 72) *
+        SAMPLE_TIME_NSECS) / 1000;
+#else
     usecs_after_sample = (int64_t) ((float) (time_sample_ptr * 
         SAMPLE_TIME_USECS) - (72.0 * SAMPLE_TIME_USECS));
+#endif
     actual_usecs = time_usecs + usecs_after_sample;
 
     if (actual_usecs > 1000000) {
@@ -583,14 +2883,27 @@ void write_packet(bool isFisb) {
 
   // Determine type of packet.
   char typeChar = 'F';
+  pthread_mutex_lock(&output.lock);
   if (!isFisb) {
     typeChar = 'A';
+    adsbPacketCount++;
+  } else {
+    fisbPacketCount++;
   }
+  pthread_mutex_unlock(&output.lock);
   
   // Calculate rssi. p_current_running_total is the average power per sample
   // for the last sync block. The extra * 10 is to get the decimal into
   // an integer form (ec_978.py will divide by 10 later).
+#ifdef FIXED_POINT
+  // Rounded to the nearest tenth of a dB like printf() does.
+  int64_t rssiDb = db_fixed(p_running_total_total, RSSI_FULL_SCALE);
+  int rssi = (int) (((rssiDb * 10) + (1 << (LOG2_FRAC_BITS - 1))) >>
+      LOG2_FRAC_BITS);
+#else
   double rssi = 10.0 * 10.0 * log10(p_current_running_total);
+#endif
+  adc_packet();
   
   // Write packet attributes to string. Double check current_running_total
   // is in bounds. If not, force it in bounds.
@@ -603,52 +2916,64 @@ void write_packet(bool isFisb) {
     actual_usecs = 999999;
   }
 
-  sprintf(attributes,"%lu.%06ld.%c.%08d.%d.%05.0lf", time_secs,
+#ifdef FIXED_POINT
+  sprintf(attributes,"%" PRId64 ".%06" PRId64 ".%c.%08d.%d.%05d", time_secs,
       actual_usecs, typeChar, current_running_total, last_sync_errors, rssi);
+#else
+  sprintf(attributes,"%" PRId64 ".%06" PRId64 ".%c.%08d.%d.%05.0lf", time_secs,
+      actual_usecs, typeChar, current_running_total, last_sync_errors, rssi);
+#endif
 
   // double to check to make sure this is ATTRIBUTE_LEN
   if (strlen(attributes) != ATTRIBUTE_LEN) {
-    fprintf(stderr, "Got %ld for attribute length, not %d. Attributes: '%s'\n",
+    fprintf(stderr, "Got %zu for attribute length, not %d. Attributes: '%s'\n",
         strlen(attributes), ATTRIBUTE_LEN, attributes);
     exit(EXIT_FAILURE);
   }
 
-  // Write ATTRIBUTE_LEN bytes of attribute information
-  int attrBytesWritten = fwrite(attributes, 1, ATTRIBUTE_LEN, stdoutbuf);
-  if (attrBytesWritten != ATTRIBUTE_LEN) {
-    fprintf(stderr, "Writing attribute, got %ld for attribute length, not %d\n",
-        strlen(attributes), ATTRIBUTE_LEN);
-    exit(EXIT_FAILURE);
-  }
+  // Get a place to put the packet. This may mean dropping it or
+  // another packet.
+  int slotNum = output_get_slot(isFisb, current_running_total);
+  output_slot_t *slot = &output.slots[slotNum];
 
-  // Get ready to write packet.
-  int bytesToWrite;
+  memcpy(slot->attributes, attributes, ATTRIBUTE_LEN);
+  slot->isFisb = isFisb;
+  slot->channel = isFisb ? output.fisbChannel : output.adsbChannel;
+  slot->level = current_running_total;
   
   // written this way for optimization. Much slower if variable used
   // vs constant.
   if (isFisb) {
     // write out packet data (FIS-B)
     for (int i = 0; i < FISB_WRITE_INTS; i++) {
-      write_data.fisb_buf_ints[i] = demod_one();
+      slot->data.fisb_buf_ints[i] = demod_one();
     }
 
-    bytesToWrite = FISB_WRITE_INTS * 4;
+    slot->bytesToWrite = FISB_WRITE_INTS * 4;
+
+    // Eye statistics are only shown by the control socket.
+    if (controlListenFd != -1)
+      eye_packet(slot->data.fisb_buf_ints, EYE_FISB_BITS);
   }
   else {
     // write out packet data (ADS-B)
     for (int i = 0; i < ADSB_WRITE_INTS; i++) {
-      write_data.fisb_buf_ints[i] = demod_one();
+      slot->data.fisb_buf_ints[i] = demod_one();
     }
 
-    bytesToWrite = ADSB_WRITE_INTS * 4;
-  }
+    slot->bytesToWrite = ADSB_WRITE_INTS * 4;
 
-  // Write packet and make sure we wrote the correct number of bytes.
-  int bytes_written = fwrite(write_data.fisb_buf_bytes, 1, bytesToWrite, stdoutbuf);
-  if (bytes_written != bytesToWrite) {
-    fprintf(stderr, "Got %d writing file\n", bytes_written);
-    exit(EXIT_FAILURE);
+    if (controlListenFd != -1)
+      eye_packet(slot->data.fisb_buf_ints, EYE_ADSB_BITS);
+
+    if (adsbShort && adsb_is_short(slot->data.fisb_buf_ints)) {
+      slot->bytesToWrite = ADSB_SHORT_WRITE_INTS * 4;
+      slot->attributes[ATTRIBUTE_TYPE_POS] = 'S';
+      adsbShortCount++;
+    }
   }
+
+  output_queue_slot(slotNum);
 }
 
 /**
@@ -738,7 +3063,7 @@ inline void process_sample() {
  * @param progName Program name (i.e. argv[0])
  */
 void printUsageThenExit(const char *progName) {
-  fprintf(stderr, "Usage: %s [-f] [-a] [-x] [-l level] -d <directory>]\n", progName);
+  fprintf(stderr, "Usage: %s [-f] [-a] [-x] [-l level] [-n|-t host:port] [-u] [-g gain] [-c port] [-b secs] [-F file] [-A file] [-T file] [-s]\n", progName);
   fprintf(stderr, "-a          Capture ADS-B packets only.\n");
   fprintf(stderr, "-f          Capture FIS-B packets only.\n");
   fprintf(stderr, "             -if neither -a or -f, both FIS-B and ADS-B are processed.\n");
@@ -746,6 +3071,16 @@ void printUsageThenExit(const char *progName) {
   fprintf(stderr, "             -default is 0.9.\n");
   fprintf(stderr, "-x          Set if reading from file and not real-time.\n");
   fprintf(stderr, "             -will make arrival times unique.\n");
+  fprintf(stderr, "-n <h:p>    Read CU8 samples from rtl_tcp server at host:port.\n");
+  fprintf(stderr, "-t <h:p>    Read CS16 samples from TCP at host:port.\n");
+  fprintf(stderr, "-u          Samples from -t are CU8, not CS16.\n");
+  fprintf(stderr, "-g <float>  Gain (dB) for rtl_tcp. Default is auto gain.\n");
+  fprintf(stderr, "-c <port>   Open control socket on 127.0.0.1:<port>.\n");
+  fprintf(stderr, "-b <secs>   Write a heartbeat frame every <secs> seconds.\n");
+  fprintf(stderr, "-F <file>   Write FIS-B packets to <file>, not standard output.\n");
+  fprintf(stderr, "-A <file>   Write ADS-B packets to <file>, not standard output.\n");
+  fprintf(stderr, "-T <file>   Also write packets to <file> if it keeps up. Up to 4.\n");
+  fprintf(stderr, "-s          Write clearly short ADS-B messages short (type 'S').\n");
   exit(EXIT_FAILURE);
 }
 
@@ -763,7 +3098,7 @@ int main(int argc, char *argv[]) {
   int opt;
 
   // handle options
-  while ((opt = getopt(argc, argv, "faxl:")) != -1) {
+  while ((opt = getopt(argc, argv, "faxl:n:t:ug:c:b:F:A:T:s")) != -1) {
     switch (opt) {
       case 'f':
         doFisb = true;
@@ -777,6 +3112,44 @@ int main(int argc, char *argv[]) {
       case 'x':
         readingFromFile = true;
         break;
+      case 'n':
+        netSource = true;
+        netIsRtlTcp = true;
+        netIsCu8 = true;
+        netHost = optarg;
+        break;
+      case 't':
+        netSource = true;
+        netHost = optarg;
+        break;
+      case 'u':
+        netIsCu8 = true;
+        break;
+      case 'g':
+        rtlTcpGain = (int)(atof(optarg) * 10.0);
+        break;
+      case 'c':
+        controlPort = atoi(optarg);
+        break;
+      case 'b':
+        heartbeatSecs = atoi(optarg);
+        break;
+      case 'F':
+        fisbOutputPath = optarg;
+        break;
+      case 'A':
+        adsbOutputPath = optarg;
+        break;
+      case 'T':
+        if (numTaps == OUTPUT_MAX_TAPS) {
+          fprintf(stderr, "At most %d taps (-T).\n\n", OUTPUT_MAX_TAPS);
+          printUsageThenExit(argv[0]);
+        }
+        tapPaths[numTaps++] = optarg;
+        break;
+      case 's':
+        adsbShort = true;
+        break;
       default:
         printUsageThenExit(argv[0]);
     }
@@ -791,14 +3164,52 @@ int main(int argc, char *argv[]) {
     doAdsb = true;
   }
 
+  // Two writers on one file would mix up packets.
+  if ((fisbOutputPath != NULL) && (adsbOutputPath != NULL) &&
+      (strcmp(fisbOutputPath, adsbOutputPath) == 0)) {
+    fprintf(stderr, "-F and -A must be different files.\n\n");
+    printUsageThenExit(argv[0]);
+  }
+
+  if (heartbeatSecs < 0) {
+    fprintf(stderr, "Heartbeat (-b) seconds must be positive.\n\n");
+    printUsageThenExit(argv[0]);
+  }
+
   // Threshold must be positive.
   if (runningThreshold < 0) {
     fprintf(stderr, "Level (-l) argument must be positive.'/'\n\n");
     printUsageThenExit(argv[0]);
   }
  
-  // Since writing to stdout, open buffered binary writer.
-  stdoutbuf = fdopen(dup(STDOUT_FILENO), "wb");
+  // Network source is given as host:port.
+  if (netSource) {
+    char *colon = strrchr(netHost, ':');
+    if ((colon == NULL) || (colon[1] == '\0')) {
+      fprintf(stderr, "Network source must be host:port.\n\n");
+      printUsageThenExit(argv[0]);
+    }
+    *colon = '\0';
+    netPort = colon + 1;
+
+    // rtl_tcp centers its 8-bit samples on 127.5.
+    for (int i = 0; i < 256; i++) {
+      cu8_to_cs16[i] = (int16_t) lround((i - 127.5) * 256.0);
+    }
+
+    pthread_t netThread;
+    if (pthread_create(&netThread, NULL, net_receive_thread, NULL) != 0) {
+      fprintf(stderr, "Could not start network thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (controlPort != 0)
+    control_init();
+
+  // Packets are written by their own threads, to buffered binary
+  // writers.
+  output_init();
 
   // Read initial block.
   read_block();
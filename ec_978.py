@@ -17,7 +17,9 @@ for FIS-B packets and ``PACKET_LENGTH_ADSB`` (3084) for ADS-B packets.
 Note that while there are two types of ADS-B packets, short and long,
 the length is set for long packets. That allows for long and short packets
 to be error corrected (you can sort of, but not absolutely, distinguish
-between the two at the time they are sent).
+between the two at the time they are sent). With ``-s``, demod_978 sends
+packets that are clearly short messages as type 'S' with
+``PACKET_LENGTH_ADSB_SHORT`` bytes, and only the short length is tried.
 
 After the packets are received, they are packed together into bytes 
 and error corrected using the Reed-Solomon parity bits. If the initial error
@@ -44,8 +46,19 @@ import pyreedsolomon as rs
 import argparse
 import glob
 import time
+import hashlib
+import struct
+import json
 from datetime import timezone, datetime, timedelta
 import shutil
+import bisect
+import socket
+import socketserver
+import threading
+import multiprocessing
+import queue
+import fcntl
+import termios
 from argparse import RawTextHelpFormatter
 
 # List of positions to shift bits by to error correct messages.
@@ -108,6 +121,24 @@ PACKET_LENGTH_FISB = 35340
 #: since this will capture all cases (long and short ADS-B).
 PACKET_LENGTH_ADSB = 3084
 
+#: Size of a short ADS-B packet in bytes (type 'S', sent by
+#: ``demod_978 -s`` when a packet is clearly a short message).
+#: Derived from (((240 + 8) * 2) + 3) * 4: 240 bits of short message and
+#: 8 guard bits. These are padded with zeros to ``PACKET_LENGTH_ADSB``
+#: when read, so everything else sees the usual length.
+PACKET_LENGTH_ADSB_SHORT = 1996
+
+#: Heartbeat frames from demod_978 (``-b``) have type 'H' in the
+#: attribute string and are followed by 8 little-endian unsigned 64-bit
+#: values: next packet sequence number, samples read, FIS-B and ADS-B
+#: packets found, FIS-B and ADS-B packets dropped by demod_978's output
+#: queue, time of the last sample read (usecs) and the heartbeat interval
+#: (msecs).
+HEARTBEAT = struct.Struct('<8Q')
+
+#: Size of a heartbeat frame in bytes.
+HEARTBEAT_LENGTH = HEARTBEAT.size
+
 # If True, show information about failed FIS-B packets as a comment.
 show_failed_fisb = False
 
@@ -152,6 +183,379 @@ f6bArrayLen = 0
 # For --f6b flag, contains contents of 1st 6 byte values.
 f6bArray = None
 
+# Set by --f6bauto. File the learned 1st 6 byte values are kept in
+# between runs. None if we are not learning them.
+f6b_auto_file = None
+
+# Learned 1st 6 byte values. Maps data channel (1-32) to a dict of
+# 12 character hex strings and the number of times each was decoded.
+f6bLearned = {}
+
+# Most learned values kept for each data channel.
+F6B_PER_CHANNEL = 3
+
+# Most learned values tried on a block 0.
+F6B_TRY = 2
+
+# When a count reaches this, all counts for the data channel are halved.
+# This lets a new station take over a data channel.
+F6B_COUNT_MAX = 1000
+
+# Seconds between saves of the learned values (also saved at exit).
+F6B_SAVE_SECS = 300
+
+# Estimated time (ms) from the start of a FIS-B packet's slot to its
+# arrival time, and the average deviation from that. Used to work out
+# the slot (and so data channel) of a packet before it is decoded.
+# Only tracked with --f6bauto or --adapt.
+slotDelay = None
+slotDelayDev = None
+
+# The slot is only estimated from the arrival time if the average
+# deviation of the delay (ms) is below this. A slot is 5.5 ms.
+SLOT_DELAY_DEV_MAX = 1.5
+
+# Held while using learned values, since late results from the deep
+# decode worker add to them from another thread.
+learnLock = threading.Lock()
+
+# Port for the control socket. Set by --ctl. None if not used.
+control_port = None
+
+# Settings that can be changed with the control socket 'set' command
+# mapped to the global holding them. All are on/off values. 'f6b' is
+# handled separately.
+CONTROL_SETTINGS = {'ff': 'show_failed_fisb', 'fa': 'show_failed_adsb', \
+    'll': 'show_lowest_levels', 'bzfb': 'block_zero_fixed_bits', \
+    'ftz': 'fix_trailing_zeros', 'apd': 'adsb_partial_decode', \
+    'fet': 'fisb_extra_timing', 'saveraw': 'save_raw_data_to_disk'}
+
+# Counters shown by the control socket 'stats' command.
+stats = {'fisb_packets': 0, 'fisb_decoded': 0, 'fisb_failed': 0, \
+    'adsb_packets': 0, 'adsb_decoded': 0, 'adsb_failed': 0, \
+    'budget_cut': 0, 'deep_queued': 0, 'deep_decoded': 0, \
+    'deep_dropped': 0, 'rs_attempts': 0, 'cache_hits': 0, \
+    'dedup_frames': 0, 'dedup_dups': 0, 'dedup_dropped': 0, \
+    'adsb_limited': 0, 'hub_sent': 0, 'hub_decoded': 0, 'hub_fallback': 0, \
+    'heartbeats': 0, 'seq_lost': 0, 'demod_dropped': 0, 'hb_latency_ms': 0, \
+    'adsb_short': 0}
+
+# Set by --hb. If True, demod_978 heartbeats are written as '#HB' lines
+# (for server_978.py).
+heartbeat_lines = False
+
+# Values from the last demod_978 heartbeat, or None.
+lastHeartbeat = None
+
+# Packets read since the last heartbeat.
+packetsSinceHeartbeat = 0
+
+# Decode budget per packet in seconds when there is no backlog. Set by
+# --budget (in milliseconds). None means no budget (try everything).
+decode_budget = None
+
+# time.perf_counter() value after which no more decode attempts are
+# started for the current packet. None if there is no budget.
+decode_deadline = None
+
+# True if the budget ran out while decoding the current packet.
+budget_was_cut = False
+
+# Backlog, as the lag between a packet's arrival time and now, at
+# which the decode budget starts to shrink, and at which it is
+# at its smallest (seconds).
+BUDGET_LAG_LOW = 0.5
+BUDGET_LAG_HIGH = 5.0
+
+# Smallest fraction of the decode budget allowed under full backlog.
+# The first shift (or ``tryFirst``) is always tried regardless.
+BUDGET_MIN_FRACTION = 0.05
+
+# Successes and seconds spent for each optional decode strategy. Used
+# to try strategies in order of yield per microsecond when a decode
+# budget is set. Starts with 10 pseudo-trials of equal cost using the
+# success percentages in the comments of blockZeroTricks(), fixZeros()
+# and adsbProcessPacket(), so the initial order matches those.
+#
+#   bzt:      block zero tricks (FIS-B block 0)
+#   ftz:      fix trailing zeros (FIS-B)
+#   prior:    force learned constant bits (FIS-B, no measured value yet)
+#   offset2:  decode again at offset 2 (FIS-B)
+#   opposite, oppoffset, offset:  ADS-B attempts after the first
+#   addr:     force recently heard addresses (ADS-B, no measured value yet)
+STRATEGY_PRIOR_SECS = 10 * 0.002
+strategyYield = {'bzt': [0.50, STRATEGY_PRIOR_SECS], \
+    'ftz': [1.37, STRATEGY_PRIOR_SECS], \
+    'prior': [0.50, STRATEGY_PRIOR_SECS], \
+    'offset2': [0.10, STRATEGY_PRIOR_SECS], \
+    'opposite': [0.29, STRATEGY_PRIOR_SECS], \
+    'oppoffset': [0.23, STRATEGY_PRIOR_SECS], \
+    'offset': [0.04, STRATEGY_PRIOR_SECS], \
+    'addr': [0.50, STRATEGY_PRIOR_SECS]}
+
+# Size of the pipe we read from. Used to judge backlog.
+stdinPipeSize = 65536
+
+# Set by --adapt. If True, the order shifts are tried in is learned
+# while running for each packet type and signal level, and the shift
+# that worked for a station's last packet is tried first.
+adapt_shifts = False
+
+# Set by --fixed. If True, shiftBits() uses integer math, for computers
+# without a floating point unit.
+fixed_point = False
+
+# Signal levels (as shown by --ll) splitting packets into level buckets
+# for --adapt and --shifts. Bucket n holds levels up to
+# ``SHIFT_LEVEL_BUCKETS[n]``.
+SHIFT_LEVEL_BUCKETS = [1, 2, 4, 8, 16, 32]
+
+# Shift tables loaded by --shifts (made by shift_train.py). Maps
+# (packet type, level bucket) to a list of shifts. Packet type is 'F',
+# 'A' or '*' (any), level bucket is an int or '*' (any).
+shiftTables = {}
+
+# When a shift's win count for a key reaches this, all counts for the
+# key are halved so the order can follow changes.
+ADAPT_COUNT_MAX = 1000
+
+# Number of times each shift worked, by (packet type, level bucket).
+# Packet type is 'F' (FIS-B) or 'A' (ADS-B).
+shiftWins = {}
+
+# Shift that worked for the last packet of a station. FIS-B stations
+# are keyed by ('F', data channel). ADS-B (and FIS-B packets whose data
+# channel can't be told before decoding) use (packet type, level
+# bucket).
+lastShift = {}
+
+# For the packet being decoded: order to try the shifts in, shift to
+# try first (-1 for none), key into ``shiftWins``, and the last shift
+# that worked (-1 for none).
+shiftOrder = SHIFT_BY_PROBABILITY
+firstShift = -1
+shiftKey = None
+winningShift = -1
+
+# Set by --priors. If True, FIS-B data bits that are (almost) always the
+# same for a station are learned from decoded packets and forced when a
+# block fails.
+learn_priors = False
+
+# Decoded packets a station needs before any of its bits are forced.
+PRIOR_MIN_DECODES = 30
+
+# Fraction of decodes a bit must have had the same value in to be forced.
+PRIOR_CONFIDENCE = 0.99
+
+# When a station reaches this many decodes, its counts are halved so
+# changes (such as new products) are followed.
+PRIOR_COUNT_MAX = 2000
+
+# Learned bits by data channel (1-32), and '*' for all stations. Each is
+# a list of the number of decodes and an nparray of shape (6, 576) with
+# the number of times each data bit of each block was 1.
+priorCounts = {}
+
+# Set by --cache. If True, FIS-B blocks that fail are compared with
+# recently decoded blocks, since the same products are sent over and over.
+block_cache = False
+
+# A failed block matches a cached block if their hard decision bytes
+# (all 92 with parity) differ in at most this many places. Different
+# blocks differ in at least 21 places, so noise would have to turn 5 or
+# more bytes into exactly the cached values to fool us.
+CACHE_MAX_DIFF = 16
+
+# Each codeword is split into this many segments for the match index. A
+# block within ``CACHE_MAX_DIFF`` of a cached one must match it exactly
+# in at least one segment.
+CACHE_SEGMENTS = CACHE_MAX_DIFF + 1
+
+# Segment boundaries in a 92 byte codeword.
+CACHE_SEGMENT_BOUNDS = [(x[0], x[-1] + 1) for x in \
+    np.array_split(np.arange(92), CACHE_SEGMENTS)]
+
+# Most blocks kept. The least recently matched are dropped first.
+CACHE_MAX = 5000
+
+# Cached blocks keyed by the block data hex. Values are the full codeword
+# as an nparray of 92 uint8. Kept in order of use (oldest first).
+blockCache = {}
+
+# Match index. Keys are (segment number, segment bytes), values are sets
+# of ``blockCache`` keys.
+blockCacheIndex = {}
+
+# Blocks added since the last job sent to the deep decode worker, which
+# keeps its own cache.
+blockCacheNew = []
+
+# Set by --dedup. FIS-B frames already sent within this many seconds
+# are duplicates. None if not removing duplicates.
+dedup_window = None
+
+# Set by --dupflag. If True, FIS-B packets with only duplicate frames are
+# sent anyway with ';dup=' added, instead of being dropped.
+dedup_flag = False
+
+# Frames sent, keyed by (frame type, product id or None, frame hash).
+# Values are the packet time the frame was last sent. Oldest first.
+dedupSeen = {}
+
+# Set by --adsbrate. If not None, an ADS-B message is only sent if the
+# aircraft's state changed or this many seconds have passed since the
+# last message sent for it.
+adsb_rate = None
+
+# Altitude change (feet) that is a change of state.
+AIRCRAFT_ALT_CHANGE = 100
+
+# Aircraft not heard for this many seconds are dropped.
+AIRCRAFT_MAX_AGE = 300
+
+# Aircraft state for --adsbrate, keyed by the address qualifier and
+# address as an int ((qualifier << 24) | address). Values are
+# dictionaries (see ``aircraftUpdate()``). Oldest heard first.
+aircraft = {}
+
+# Set by --report. Seconds (of packet time) between station reception
+# reports written to standard error. None if not reporting.
+station_report = None
+
+# FIS-B counts for the station report by data channel (0 for failed
+# packets whose data channel can't be told). Values are dictionaries
+# (see ``stationCount()``).
+stationStats = {}
+
+# Packet time the current report period started, or None.
+stationReportStart = None
+
+# Strategies that decoded parts of the current packet (see
+# ``recordStrategy()``). Reset for each packet.
+packetStrategies = []
+
+# Set by --addr. If True, ADS-B packets that fail are tried again with
+# the address forced to that of an aircraft heard recently at a similar
+# signal level.
+adsb_address_priors = False
+
+# Aircraft heard within this many seconds are candidates.
+ADDR_WINDOW_SECS = 60
+
+# A candidate's last signal level must be within this factor of the
+# failed packet's level.
+ADDR_LEVEL_RATIO = 2.0
+
+# Most candidates tried for a packet, most recently heard first.
+ADDR_TRY = 3
+
+# Most aircraft kept. The oldest are dropped first.
+ADDR_MAX = 2000
+
+# Aircraft heard, keyed by the address qualifier and address as an int
+# ((qualifier << 24) | address). Values are [time heard, signal level].
+# Python dicts keep insertion order, so entries are moved to the end
+# when heard again and the oldest are at the front.
+addrTable = {}
+
+# Bit positions of the address qualifier (low 3 bits of byte 0) and the
+# address (bytes 1-3) in an ADS-B message.
+ADDR_BIT_POSITIONS = np.arange(5, 32)
+
+# Set by --deep. If True, packets get a fast first pass inline and
+# the packets that fail are decoded again with everything we have by a
+# low priority worker process.
+deep_decode = False
+
+# True while doing the fast first pass. Limits ``tryShiftBits()`` to
+# the first ``FAST_PASS_SHIFTS`` shifts and skips the extra strategies
+# (except trying the other ADS-B length).
+fast_pass = False
+
+# Number of ``SHIFT_BY_PROBABILITY`` shifts tried by the fast pass.
+# The first 5 decode almost all packets that will decode at all.
+FAST_PASS_SHIFTS = 5
+
+# Most failed packets waiting for the deep decode worker. Packets
+# arriving when it is full are counted as failed without a second try.
+DEEP_QUEUE_MAX = 200
+
+# Niceness added to the deep decode worker.
+DEEP_NICE = 10
+
+# Globals sent to the deep decode worker with each packet, so that
+# changes made with the control socket are used.
+DEEP_SETTINGS = ['show_failed_fisb', 'show_failed_adsb', \
+    'adsb_partial_decode', 'fisb_extra_timing', 'output_d978', \
+    'output_d978fa', 'block_zero_fixed_bits', 'fix_trailing_zeros', \
+    'replace_f6b', 'f6bArray', 'f6bArrayLen', 'writingErrorFiles', \
+    'dir_out_errors', 'f6b_auto_file', 'adsb_address_priors', \
+    'block_cache']
+
+# Set by --hub. (host, port) of a hub that decodes packets that failed
+# the fast pass (see ``mainHubServe()``). The local deep decode worker is
+# used when the hub can't be reached or has no credits. None if no hub.
+hub_address = None
+
+# Set by --hubjobs. Number of worker processes when running as a hub.
+hub_jobs = os.cpu_count()
+
+# Seconds between tries to connect to the hub.
+HUB_RETRY_SECS = 10
+
+# Seconds to wait at the end for the hub's last results.
+HUB_DRAIN_SECS = 30
+
+# Credits a hub gives each connection for each of its workers. A packet
+# can only be sent when we have a credit, and each result returns one.
+HUB_CREDITS_PER_JOB = 2
+
+# Largest frame payload accepted.
+HUB_FRAME_MAX = 1 << 20
+
+# Frame header: type and payload length. Types are b'J' (job: tag,
+# attribute string, settings length, settings JSON, packet), b'R'
+# (result: tag, decoded, short, result string) and b'C' (credits).
+HUB_FRAME = struct.Struct('<cI')
+
+# Settings sent to the hub with each packet (the --f6b values are sent
+# too). Learned values are not sent. Failure strings and error files are
+# not shown for packets the hub fails.
+HUB_SETTINGS = ['adsb_partial_decode', 'fisb_extra_timing', \
+    'block_zero_fixed_bits', 'fix_trailing_zeros', 'replace_f6b']
+
+# Hub connection (client side). Packets sent to the hub and waiting for
+# results are kept by tag, so they can go to the local deep decode worker
+# if the connection drops. All are protected by hubLock.
+hubSock = None
+hubCredits = 0
+hubNextTry = 0
+hubNextTag = 0
+hubOutstanding = {}
+
+# Hub connections (hub side) by connection id. Values are the socket and
+# a lock for sending. Protected by hubLock.
+hubConnections = {}
+hubNextConn = 0
+
+hubLock = threading.Lock()
+
+# Deep decode worker job queue. Used for packets the hub didn't take.
+deepJobQueue = None
+
+# Job queue for the hub's workers (hub side).
+hubJobQueue = None
+
+# Lowest signal level decoded for FIS-B and ADS-B (short and long).
+# These start out as higher than we will ever see.
+lowestLevels = {'fisb': 1000000000, 'adsbs': 1000000000, \
+    'adsbl': 1000000000}
+
+# Held while writing a result, since late results from the deep decode
+# worker are written by another thread.
+outputLock = threading.Lock()
+
 # Reed-Solomon error correction Ground Uplink parameters:
 #   Symbol Size: 8
 #   Message Symbols: 72 (ADS-B short: 144, ADS-B long: 272)
@@ -165,6 +569,471 @@ rsAdsbS = rs.Reed_Solomon(8,18,30,0x187,120,1,12)
 rsAdsbL = rs.Reed_Solomon(8,34,48,0x187,120,1,14)
 rsFisb = rs.Reed_Solomon(8,72,92,0x187,120,1,20)
 
+def setShiftOrder(timeStr, rawSignalStrength, isFisbPacket):
+  """
+  Set the order of shifts for the next packet. This is the ``--shifts``
+  table for the packet type and level bucket (or
+  ``SHIFT_BY_PROBABILITY``). With ``--adapt`` shifts are then ordered by
+  the number of times they worked for this packet type and level bucket,
+  ties keeping the table order.
+
+  Args:
+    timeStr (str): Arrival time of the packet (epoch seconds).
+    rawSignalStrength (float): Signal strength from the attributes.
+    isFisbPacket (bool): ``True`` if FIS-B.
+  """
+  global shiftOrder, firstShift, shiftKey, winningShift
+
+  winningShift = -1
+
+  if not (adapt_shifts or shiftTables):
+    return
+
+  shiftKey = ('F' if isFisbPacket else 'A', \
+      bisect.bisect_left(SHIFT_LEVEL_BUCKETS, rawSignalStrength))
+
+  # Start with the most specific --shifts table there is.
+  shiftOrder = SHIFT_BY_PROBABILITY
+  for key in [shiftKey, (shiftKey[0], '*'), ('*', '*')]:
+    if key in shiftTables:
+      shiftOrder = shiftTables[key]
+      break
+
+  if not adapt_shifts:
+    return
+
+  wins = shiftWins.get(shiftKey, {})
+  shiftOrder = sorted(shiftOrder, key=lambda x: -wins.get(x, 0))
+
+  station = shiftKey
+  if isFisbPacket:
+    dataChannel = expectedDataChannel(timeStr)
+    if dataChannel is not None:
+      station = ('F', dataChannel)
+
+  firstShift = lastShift.get(station, -1)
+
+def loadShiftTables(path):
+  """
+  Load shift tables made by ``shift_train.py`` (``--shifts``).
+
+  Lines starting with ``#`` are comments. Other lines are the packet
+  type ('F', 'A' or '*'), the level bucket (a number or '*') and the
+  shifts to try in order.
+
+  Args:
+    path (str): File to load.
+
+  Raises:
+    ValueError: If a line can't be understood.
+  """
+  with open(path, 'r') as f:
+    for line in f:
+      words = line.split()
+      if (len(words) == 0) or words[0].startswith('#'):
+        continue
+
+      try:
+        if (len(words) < 3) or (words[0] not in ['F', 'A', '*']):
+          raise ValueError
+
+        bucket = words[1]
+        if bucket != '*':
+          bucket = int(bucket)
+
+        shifts = [float(x) for x in words[2:]]
+        if any(abs(x) >= 1 for x in shifts):
+          raise ValueError
+      except ValueError:
+        raise ValueError(f'Bad shift table line: {line.strip()}')
+
+      shiftTables[(words[0], bucket)] = shifts
+
+def priorLearn(resultStr, dataChannel):
+  """
+  Count the data bits of a decoded FIS-B packet for ``--priors``.
+
+  Args:
+    resultStr (str): Result string ('+' then the hex of the 6 blocks).
+    dataChannel (int): Data channel (1-32) of the packet.
+  """
+  bits = np.unpackbits(np.frombuffer(bytes.fromhex( \
+      resultStr[1:1 + (6 * 72 * 2)]), np.uint8)).reshape(6, 576)
+
+  with learnLock:
+    for key in [dataChannel, '*']:
+      entry = priorCounts.setdefault(key, [0, np.zeros((6, 576), np.int32)])
+      entry[0] += 1
+      entry[1] += bits
+
+      if entry[0] >= PRIOR_COUNT_MAX:
+        entry[0] //= 2
+        entry[1] //= 2
+
+def priorKey(timeStr):
+  """
+  Find the ``priorCounts`` key to use for a packet. This is the data
+  channel we expect it was sent on (see ``expectedDataChannel()``) if
+  that station has enough decodes, else '*'.
+
+  Args:
+    timeStr (str): Epoch UTC time the message arrived.
+
+  Returns:
+    Data channel (int) or '*'.
+  """
+  dataChannel = expectedDataChannel(timeStr)
+
+  with learnLock:
+    if (dataChannel in priorCounts) and \
+        (priorCounts[dataChannel][0] >= PRIOR_MIN_DECODES):
+      return dataChannel
+
+  return '*'
+
+def priorMask(timeStr, block):
+  """
+  Get the learned bits to force for a FIS-B block (``--priors``). These
+  are the data bits that had the same value in at least
+  ``PRIOR_CONFIDENCE`` of the station's decodes. This is the block zero
+  fixed bits trick, learned for any block.
+
+  Args:
+    timeStr (str): Epoch UTC time the message arrived.
+    block (int): Block number (0-5).
+
+  Returns:
+    tuple: Array of bit positions and array of values (+10000 for 1,
+    -10000 for 0) for ``tryShiftBits()``, or ``None`` if there are no bits
+    to force.
+  """
+  key = priorKey(timeStr)
+
+  with learnLock:
+    if (key not in priorCounts) or \
+        (priorCounts[key][0] < PRIOR_MIN_DECODES):
+      return None
+
+    fraction = priorCounts[key][1][block] / priorCounts[key][0]
+
+  positions = np.where((fraction >= PRIOR_CONFIDENCE) | \
+      (fraction <= (1 - PRIOR_CONFIDENCE)))[0]
+
+  if len(positions) == 0:
+    return None
+
+  return positions, np.where(fraction[positions] >= PRIOR_CONFIDENCE, \
+      10000, -10000)
+
+def blockCacheSegments(codeword):
+  """
+  Get the ``blockCacheIndex`` keys for a codeword.
+
+  Args:
+    codeword (nparray): 92 uint8 bytes.
+
+  Returns:
+    list: ``(segment number, segment bytes)`` for each segment.
+  """
+  return [(i, codeword[x[0]:x[1]].tobytes()) for i, x in \
+      enumerate(CACHE_SEGMENT_BOUNDS)]
+
+def blockCacheLearn(resultStr):
+  """
+  Add the blocks of a decoded FIS-B packet to the cache (``--cache``).
+  Blocks of all zeros (empty frames) are skipped since
+  ``block0ThoroughCheck()`` takes care of them.
+
+  Args:
+    resultStr (str): Result string ('+' then 6 blocks of hex).
+  """
+  for block in range(0, 6):
+    hexBlock = resultStr[1 + (block * 144):1 + ((block + 1) * 144)]
+
+    if hexBlock.strip('0') == '':
+      continue
+
+    with learnLock:
+      if blockCacheAdd(hexBlock) and deep_decode:
+        blockCacheNew.append(hexBlock)
+
+def blockCacheAdd(hexBlock):
+  """
+  Add a block to the cache, or mark it as just used if already there.
+  Must be called with ``learnLock`` held.
+
+  Args:
+    hexBlock (str): Block data hex.
+
+  Returns:
+    bool: ``True`` if the block was not already in the cache.
+  """
+  codeword = blockCache.pop(hexBlock, None)
+  isNew = codeword is None
+
+  if isNew:
+    codeword = np.asarray(rsFisb.encode(np.frombuffer( \
+        bytes.fromhex(hexBlock), np.uint8)), dtype=np.uint8)
+
+    for key in blockCacheSegments(codeword):
+      blockCacheIndex.setdefault(key, set()).add(hexBlock)
+
+  blockCache[hexBlock] = codeword
+
+  # Drop the oldest if too many.
+  while len(blockCache) > CACHE_MAX:
+    oldHex = next(iter(blockCache))
+    oldCodeword = blockCache.pop(oldHex)
+
+    for key in blockCacheSegments(oldCodeword):
+      blockCacheIndex[key].discard(oldHex)
+      if len(blockCacheIndex[key]) == 0:
+        del blockCacheIndex[key]
+
+  return isNew
+
+def blockCacheMatch(bits):
+  """
+  See if a failed FIS-B block is one we decoded recently (``--cache``).
+
+  Cached blocks sharing a segment with the block's hard decision bytes
+  are compared with it. The closest is used if it is within
+  ``CACHE_MAX_DIFF`` bytes and no other is as close. Cached blocks are
+  valid codewords, so this is the same check as Reed-Solomon decoding
+  with a larger error limit, made safe by knowing what to expect.
+
+  Args:
+    bits (nparray): int32 array of the block's bits.
+
+  Returns:
+    tuple: Tuple containing:
+
+    * Hex string of the block data if matched, else ``None``.
+    * Number of bytes that differed, or 98 if not matched.
+  """
+  byts = np.packbits(np.where((bits > 0), 1, 0))
+
+  with learnLock:
+    candidates = set()
+    for key in blockCacheSegments(byts):
+      candidates |= blockCacheIndex.get(key, set())
+
+    distances = sorted((int(np.count_nonzero(blockCache[x] != byts)), x) \
+        for x in candidates)
+
+    if (len(distances) == 0) or (distances[0][0] > CACHE_MAX_DIFF) or \
+        ((len(distances) > 1) and (distances[1][0] == distances[0][0])):
+      return None, 98
+
+    distance, hexBlock = distances[0]
+
+    # Move to the end so it is kept.
+    blockCache[hexBlock] = blockCache.pop(hexBlock)
+
+  stats['cache_hits'] += 1
+  return hexBlock, distance
+
+def addrLearn(hexBlock, timeStr, level):
+  """
+  Remember the address of a decoded ADS-B packet for ``--addr``.
+
+  Args:
+    hexBlock (str): ADS-B message hex (without the leading '-').
+    timeStr (str): Epoch UTC time the message arrived.
+    level (float): Signal level of the packet.
+  """
+  key = int(hexBlock[0:8], 16) & 0x07ffffff
+
+  with learnLock:
+    addrTable.pop(key, None)
+    addrTable[key] = [float(timeStr), level]
+
+    # Drop the oldest if too many.
+    while len(addrTable) > ADDR_MAX:
+      del addrTable[next(iter(addrTable))]
+
+def addrCandidates(timeStr, level):
+  """
+  Find the aircraft a failed ADS-B packet most likely came from: heard
+  in the last ``ADDR_WINDOW_SECS`` at a signal level within
+  ``ADDR_LEVEL_RATIO``, most recent first.
+
+  Args:
+    timeStr (str): Epoch UTC time the message arrived.
+    level (float): Signal level of the packet.
+
+  Returns:
+    list: Up to ``ADDR_TRY`` keys (see ``addrTable``).
+  """
+  timeValue = float(timeStr)
+  candidates = []
+
+  with learnLock:
+    for key in reversed(addrTable):
+      heard, heardLevel = addrTable[key]
+
+      if (timeValue - heard) > ADDR_WINDOW_SECS:
+        break
+
+      if (level <= 0) or (heardLevel <= 0) or \
+          (max(level, heardLevel) / min(level, heardLevel) > ADDR_LEVEL_RATIO):
+        continue
+
+      candidates.append(key)
+      if len(candidates) == ADDR_TRY:
+        break
+
+  return candidates
+
+def adsbAddressDecode(samples, offset, isShort, timeStr, level):
+  """
+  Try to error correct an ADS-B message with the address qualifier and
+  address forced to those of aircraft heard recently (``--addr``). Both
+  lengths are tried, the guessed one first. The decoded address must be
+  the forced one.
+
+  Args:
+    samples (nparray): int32 array of samples.
+    offset (int): Offset, normally 1 (see ``adsbDecode()``).
+    isShort (bool): ``True`` if we guessed a short ADS-B message.
+    timeStr (str): Epoch UTC time the message arrived.
+    level (float): Signal level of the packet.
+
+  Returns:
+    tuple: Same as ``adsbDecode()``.
+  """
+  for key in addrCandidates(timeStr, level):
+    keyBits = np.unpackbits(np.array([key >> 24, (key >> 16) & 0xff, \
+        (key >> 8) & 0xff, key & 0xff], dtype=np.uint8))[5:32]
+    forced = (ADDR_BIT_POSITIONS, np.where(keyBits == 1, 10000, -10000))
+
+    for short in [isShort, not isShort]:
+      if budgetExhausted():
+        return False, None, 98
+
+      status, hexBlock, errs = adsbDecode(samples, offset, short, forced)
+
+      if status and ((int(hexBlock[0:8], 16) & 0x07ffffff) == key):
+        return status, hexBlock, errs
+
+  return False, None, 98
+
+def shiftWorked(shift):
+  """
+  Count a shift that worked (``--adapt``).
+
+  Args:
+    shift (float): Shift that worked.
+  """
+  global winningShift
+
+  if not adapt_shifts:
+    return
+
+  winningShift = shift
+
+  wins = shiftWins.setdefault(shiftKey, {})
+  wins[shift] = wins.get(shift, 0) + 1
+
+  if wins[shift] >= ADAPT_COUNT_MAX:
+    for x in wins:
+      wins[x] //= 2
+
+def backlogFraction(timeStr):
+  """
+  Estimate how far behind we are, as a value from 0 (keeping up) to
+  1 (far behind).
+
+  Two measures are used and the largest taken: the lag between the
+  packet's arrival time and now, and how full the standard input pipe
+  is.
+
+  Args:
+    timeStr (str): Arrival time of the packet (epoch seconds).
+
+  Returns:
+    float: Backlog fraction 0.0 - 1.0.
+  """
+  lag = time.time() - float(timeStr)
+  lagFraction = (lag - BUDGET_LAG_LOW) / (BUDGET_LAG_HIGH - BUDGET_LAG_LOW)
+
+  try:
+    waiting = int.from_bytes(fcntl.ioctl(sys.stdin.fileno(), \
+        termios.FIONREAD, b'\0\0\0\0'), sys.byteorder)
+    pipeFraction = waiting / stdinPipeSize
+  except OSError:
+    pipeFraction = 0.0
+
+  return min(1.0, max(0.0, lagFraction, pipeFraction))
+
+def setDecodeBudget(timeStr):
+  """
+  Set the deadline for decoding the next packet. The budget set by
+  ``--budget`` shrinks as the backlog grows, down to
+  ``BUDGET_MIN_FRACTION`` of the budget.
+
+  Args:
+    timeStr (str): Arrival time of the packet (epoch seconds).
+  """
+  global decode_deadline, budget_was_cut
+
+  budget_was_cut = False
+
+  if decode_budget is None:
+    decode_deadline = None
+    return
+
+  fraction = max(BUDGET_MIN_FRACTION, 1.0 - backlogFraction(timeStr))
+  decode_deadline = time.perf_counter() + (decode_budget * fraction)
+
+def budgetExhausted():
+  """
+  Check if the decode budget for the current packet is used up.
+
+  Returns:
+    bool: ``True`` if no more decode attempts should be started.
+  """
+  global budget_was_cut
+
+  if (decode_deadline is None) or (time.perf_counter() < decode_deadline):
+    return False
+
+  budget_was_cut = True
+  return True
+
+def orderStrategies(names):
+  """
+  Order optional decode strategies by measured yield per microsecond,
+  best first. Only done when there is a decode budget, otherwise
+  the list is returned as is.
+
+  Args:
+    names (list): Strategy names (keys of ``strategyYield``).
+
+  Returns:
+    list: Strategy names in the order to try them.
+  """
+  if decode_budget is None:
+    return names
+
+  return sorted(names, key=lambda x: strategyYield[x][0] / \
+      strategyYield[x][1], reverse=True)
+
+def recordStrategy(name, success, startTime):
+  """
+  Record the result of a decode strategy for ``orderStrategies()``.
+
+  Args:
+    name (str): Strategy name (key of ``strategyYield``).
+    success (bool): ``True`` if the strategy decoded.
+    startTime (float): ``time.perf_counter()`` when the strategy started.
+  """
+  entry = strategyYield[name]
+  if success:
+    entry[0] += 1
+    packetStrategies.append(name)
+  entry[1] += time.perf_counter() - startTime
+
 def block0ThoroughCheck(hexBlocks):
   """
   Look at all consecutive blocks starting with block 0 and see
@@ -233,7 +1102,87 @@ def block0ThoroughCheck(hexBlocks):
   # Didn't find anything
   return False, hexBlocks
 
-def packAndTest(rs, bits, f6b = False):
+def fisbFrames(hexData):
+  """
+  Split FIS-B packet data into UAT frames.
+
+  Each frame starts with 9 bits of length and 4 bits of frame type. For
+  APDU frames (type 0), the product id is the 11 bits following the A,
+  G, and P flags of the APDU header. A length of zero ends the frames.
+
+  Args:
+    hexData (str): Hex of all 6 blocks.
+
+  Returns:
+    list: ``(frame type, product id or None, frame bytes)`` for each
+    frame.
+  """
+  dataBytes = bytes.fromhex(hexData)
+  dataBytesLen = len(dataBytes)
+  frames = []
+
+  bytePtr = 8
+
+  while bytePtr + 1 < dataBytesLen:
+    uatFrameLen = (dataBytes[bytePtr] << 1) | (dataBytes[bytePtr + 1] >> 7)
+
+    if (uatFrameLen == 0) or (bytePtr + 2 + uatFrameLen > dataBytesLen):
+      break
+
+    frameType = dataBytes[bytePtr + 1] & 0x0f
+    frame = dataBytes[bytePtr + 2:bytePtr + 2 + uatFrameLen]
+
+    productId = None
+    if (frameType == 0) and (uatFrameLen >= 2):
+      productId = ((frame[0] & 0x1f) << 6) | (frame[1] >> 2)
+
+    frames.append((frameType, productId, frame))
+    bytePtr += uatFrameLen + 2
+
+  return frames
+
+def fisbDuplicates(resultStr, timeStr):
+  """
+  Count the frames of a FIS-B packet already sent within
+  ``dedup_window`` seconds (``--dedup``). New frames are remembered with
+  the packet time. Duplicates keep the time they were first sent, so a
+  frame is sent again once the window has passed.
+
+  Args:
+    resultStr (str): Result string ('+' then 6 blocks of hex).
+    timeStr (str): Epoch UTC time the message arrived.
+
+  Returns:
+    tuple: Tuple containing:
+
+    * Number of duplicate frames.
+    * Number of frames.
+  """
+  timeValue = float(timeStr)
+  frames = fisbFrames(resultStr[1:1 + (6 * 72 * 2)])
+  dups = 0
+
+  with learnLock:
+    # Forget frames older than the window.
+    while (len(dedupSeen) > 0) and \
+        ((timeValue - next(iter(dedupSeen.values()))) > dedup_window):
+      del dedupSeen[next(iter(dedupSeen))]
+
+    for frameType, productId, frame in frames:
+      key = (frameType, productId, \
+          hashlib.blake2b(frame, digest_size=16).digest())
+
+      if key in dedupSeen:
+        dups += 1
+      else:
+        dedupSeen[key] = timeValue
+
+  stats['dedup_frames'] += len(frames)
+  stats['dedup_dups'] += dups
+
+  return dups, len(frames)
+
+def packAndTest(rs, bits, f6b = None):
   """
   Take a set of integers, each integer representing a
   single bit, and turn them into binary and pack them into
@@ -241,12 +1190,13 @@ def packAndTest(rs, bits, f6b = False):
 
   Args:
     rs (reed-solomon object): Reed-Solomon object to use.
-      This object is different for FIS-B, 
+      This object is different for FIS-B,
       ADS-B short, and ADS-B long.
     bits (nparray): int32 array containing one integer per bit
       for a single FIS-B block or an entire ADS-B message.
-    f6b (bool): ``True`` if we are forcing the first 6 bytes
-      of FIS-B block 0 to be a predetermined value. Otherwise ``False``.
+    f6b (nparray): Array of shape (n, 6) of values to force the first 6
+      bytes of FIS-B block 0 to, each tried in turn. ``None`` (or empty)
+      if not forcing them.
 
   Returns:
     tuple: Tuple containing:
@@ -258,21 +1208,23 @@ def packAndTest(rs, bits, f6b = False):
   # Turn integers to 1/0 bits and pack in bytes.
   byts = np.packbits(np.where((bits > 0), 1, 0))
 
-  if not f6b:
+  if (f6b is None) or (len(f6b) == 0):
     # Do Reed-Solomon error correction.
+    stats['rs_attempts'] += 1
     errCorrected, errs = rs.decode(byts)
 
     if errs >= 0:
       errCorrectedHex = errCorrected.tobytes().hex()
-      return errCorrectedHex, errs      
+      return errCorrectedHex, errs
     else:
       return None, errs
   else:
     # Try forced value for each entry in list.
-    for i in range(0, f6bArrayLen):
-      byts[0:6] = f6bArray[i][0:6]
+    for f6bValue in f6b:
+      byts[0:6] = f6bValue[0:6]
 
       # Do Reed-Solomon error correction.
+      stats['rs_attempts'] += 1
       errCorrected, errs = rs.decode(byts)
   
       if errs >= 0:
@@ -409,9 +1361,18 @@ def shiftBits(bits, neighborBits, shiftAmount):
     shiftAmount (float): Amount to shift bits toward the 
       ``neighborBits`` as a percentage.
 
+  With ``--fixed`` the shift is rounded to a whole percentage and the
+  math is done with int64's. Only the sign of each shifted bit is used
+  (see ``packAndTest()``), so the result isn't divided by 2 or 100.
+  The signs are the same as the float version.
+
   Returns:
     nparray:  ``bits`` array after shifting.
   """
+  if fixed_point:
+    return (bits.astype(np.int64) * 100) + \
+        (neighborBits.astype(np.int64) * int(round(shiftAmount * 100)))
+
   # Add a percentage of a neighbor bit to the sample bit.
   # Samples are positive and negative numbers, so this
   # will either raise or lower the sample point.
@@ -432,8 +1393,31 @@ def shiftBits(bits, neighborBits, shiftAmount):
 
   return shiftedBits
 
+def applyShift(bits, bitsBefore, bitsAfter, shift):
+  """
+  Shift bits toward the bits before (positive ``shift``) or the bits
+  after (negative ``shift``) using ``shiftBits()``.
+
+  Args:
+    bits (nparray): Integers representing the current packet.
+    bitsBefore (nparray): Integers representing the bits
+      before the current packet.
+    bitsAfter (nparray): Integers representing the bits
+      after the current packet.
+    shift (float): Shift amount. 0 returns ``bits`` itself.
+
+  Returns:
+    nparray: Shifted bits.
+  """
+  if shift == 0:
+    return bits
+  elif shift > 0:
+    return shiftBits(bits, bitsBefore, shift)
+  else:
+    return shiftBits(bits, bitsAfter, -shift)
+
 def tryShiftBits(rs, bits, bitsBefore, bitsAfter, tryFirst, \
-      f6b = False, block0FixedBits = False):
+      f6b = None, block0FixedBits = False, forced = None):
   """
   Given 3 packets of data (sample, before sample, and
   after sample), error correct the sample using various shifts.
@@ -454,12 +1438,14 @@ def tryShiftBits(rs, bits, bitsBefore, bitsAfter, tryFirst, \
     tryFirst (int): Try this shift first. Is ignored if -1.
       This is used for FIS-B packets to set the shift to one
       that worked for a previous shift.
-    f6b (bool): ``True`` if we are to replace the first 6 bytes of a block
-      0 packet with a set of fixed values. If this is ``True``, it is assumed that
+    f6b (nparray): Values to replace the first 6 bytes of a block 0 packet
+      with (see ``packAndTest()``), or ``None``. If given, it is assumed that
       ``bits`` is from a block 0 packet.
     block0FixedBits (bool): ``True`` if we are to force a set of constant bits
       for block 0. If ``True``, it is assumed that ``bits`` are from a block
       0 packet.
+    forced (tuple): Learned bits to force (see ``priorMask()``), as an
+      array of bit positions and an array of values, or ``None``.
 
   Returns:
     tuple: Tuple containing:
@@ -475,30 +1461,34 @@ def tryShiftBits(rs, bits, bitsBefore, bitsAfter, tryFirst, \
   # If a previous packet was decoded with a shift, use that shift as the
   # first attempt. It will almost always be successful.
   if tryFirst != -1:
-    if tryFirst == 0:
-      shiftedBits = bits
-    elif tryFirst > 0:
-      shiftedBits = shiftBits(bits, bitsBefore, tryFirst)
-    else:
-      shiftedBits = shiftBits(bits, bitsAfter, -tryFirst)
+    shiftedBits = applyShift(bits, bitsBefore, bitsAfter, tryFirst)
+
+    if forced is not None:
+      shiftedBits = np.copy(shiftedBits)
+      shiftedBits[forced[0]] = forced[1]
 
     errCorrectedHex, errs = packAndTest(rs, shiftedBits, f6b)
     if errs >= 0:
       return True, errCorrectedHex, errs, tryFirst
 
-  # Try all shifts in ``SHIFT_BY_PROBABILITY`` list.
-  for shift in SHIFT_BY_PROBABILITY:
+  # Try all shifts in ``SHIFT_BY_PROBABILITY`` list, or the order
+  # learned by --adapt (only the most likely ones if this is the fast
+  # pass).
+  shifts = shiftOrder
+  if fast_pass:
+    shifts = shiftOrder[:FAST_PASS_SHIFTS]
+
+  for i, shift in enumerate(shifts):
     # Don't try a shift we already tried
     if shift == tryFirst:
       continue
 
-    if shift == 0:
-      shiftedBits = bits
-    elif shift > 0:
-      shiftedBits = shiftBits(bits, bitsBefore, shift)
-    else:
-      shiftedBits = shiftBits(bits, bitsAfter, -shift)
-  
+    # Always try the first shift, then stop if out of time.
+    if (i != 0) and budgetExhausted():
+      break
+
+    shiftedBits = applyShift(bits, bitsBefore, bitsAfter, shift)
+
     if block0FixedBits:
       # For block zero fixed bits, force any fixed bits to 
       # the appropriate value. This will only be called for
@@ -516,14 +1506,18 @@ def tryShiftBits(rs, bits, bitsBefore, bitsAfter, tryFirst, \
       shiftedBits[73] = -10000   # Reserved  (UAT Frame byte 2)
       shiftedBits[74] = -10000   # Reserved  (UAT Frame byte 2)
       shiftedBits[75] = -10000   # Reserved  (UAT Frame byte 2)
-      
+
+    if forced is not None:
+      shiftedBits = np.copy(shiftedBits)
+      shiftedBits[forced[0]] = forced[1]
+
     errCorrectedHex, errs = packAndTest(rs, shiftedBits, f6b)
     if errs >= 0:
       return True, errCorrectedHex, errs, shift
 
   return False, None, 98, -1
 
-def blockZeroTricks(bits, bitsBefore, bitsAfter, hexBlocks):
+def blockZeroTricks(bits, bitsBefore, bitsAfter, hexBlocks, timeStr):
   """
   For a block zero packet, this will force the
   first 6 bytes to be a particular value, and/or set a number of bits
@@ -533,7 +1527,9 @@ def blockZeroTricks(bits, bitsBefore, bitsAfter, hexBlocks):
   ground station. With the receiver at a fixed location, only one value
   will usually be received. These can be forced into ``bits``. This is set with
   the ``--f6b`` flag. It is possible to provide more than one set of 6 bytes
-  with the ``--f6b`` flag. If provided, all will be tried.
+  with the ``--f6b`` flag. If provided, all will be tried. With ``--f6bauto``
+  the values are learned from decoded packets, and the most likely ones for
+  the packet's slot are tried as well (see ``f6bCandidates()``).
 
   Block 0 fixed bits are a set of bits always set (either 1 or 0) in block 0.
   This option is normally on, but can be turned off with the ``--nobzfb`` flag.
@@ -549,7 +1545,8 @@ def blockZeroTricks(bits, bitsBefore, bitsAfter, hexBlocks):
       after the current packet.
     hexBlocks (list): 6 item list containing 1 hex string for each decoded hex
       block, or ``None``.
-    
+    timeStr (str): Arrival time of the packet (epoch seconds).
+
   Returns:
     tuple: Tuple containing:
 
@@ -566,7 +1563,7 @@ def blockZeroTricks(bits, bitsBefore, bitsAfter, hexBlocks):
   #   block zero fix only:   756 (0.7%)
   #   combined:             5564 (5.0%)
   status, errCorrectedHex, errs, _ = tryShiftBits(rsFisb, bits, bitsBefore, \
-        bitsAfter, -1, replace_f6b, block_zero_fixed_bits)
+        bitsAfter, -1, f6bCandidates(timeStr), block_zero_fixed_bits)
   if status:
     hexBlocks[0] = errCorrectedHex
     return True, hexBlocks, errs
@@ -731,7 +1728,7 @@ def fixZeros(block):
 
   return foundAnyZeros, block
 
-def fisbDecode(samples, offset, hexBlocks, hexErrs):
+def fisbDecode(samples, offset, hexBlocks, hexErrs, timeStr):
   """
   Given a FIS-B raw message, attempt to error correct all blocks.
 
@@ -758,6 +1755,7 @@ def fisbDecode(samples, offset, hexBlocks, hexErrs):
       the error count for each FIS-B block. When first called with an offset of 
       1, will be set to a list of 6 ``99`` values. ``99`` indicates no
       attempt to decode a block has been made.
+    timeStr (str): Arrival time of the packet (epoch seconds).
 
   Returns:
     tuple: Tuple containing:
@@ -768,7 +1766,8 @@ def fisbDecode(samples, offset, hexBlocks, hexErrs):
       hex string with the error corrected value.
     * Updated version of ``hexErrs`` which will be a 6 item list
       with each element being number of errors found in the block
-      (0-10), or ``98`` for a block that failed to error correct, and ``99`` if
+      (0-10, or up to ``CACHE_MAX_DIFF`` for a ``--cache`` match), or
+      ``98`` for a block that failed to error correct, and ``99`` if
       the block was not checked for errors.
   """
   # Create hexBlocks if first time call.
@@ -779,7 +1778,7 @@ def fisbDecode(samples, offset, hexBlocks, hexErrs):
   if hexErrs == None:
     hexErrs = [99, 99, 99, 99, 99, 99]
 
-  shiftThatWorked = -1
+  shiftThatWorked = firstShift
 
   # Loop and try to error correct each block
   for block in range(0, 6):
@@ -797,6 +1796,7 @@ def fisbDecode(samples, offset, hexBlocks, hexErrs):
     if status:
       # Start next block with the shift that worked.
       shiftThatWorked = shift
+      shiftWorked(shift)
 
       hexBlocks[block] = errCorrectedHex
 
@@ -811,28 +1811,66 @@ def fisbDecode(samples, offset, hexBlocks, hexErrs):
 
       continue
 
-    # Extra checks for block 0
-    if block == 0:
-      if replace_f6b or block_zero_fixed_bits:
-        status, hexBlocks, hexErrs[block] = blockZeroTricks(bits, \
-            bitsBefore, bitsAfter, hexBlocks)
-        if status:
-          foundEmptyFrame, hexBlocks = block0ThoroughCheck(hexBlocks)
-          if foundEmptyFrame:
-            return True, hexBlocks, hexErrs
-          continue
-    
-    # Look for blocks with trailing zeros
-    if fix_trailing_zeros:
-      foundAnyZeros, bits = fixZeros(bits)
-      if foundAnyZeros:
-        status, hexBlocks[block], hexErrs[block], shift = tryShiftBits(rsFisb, \
-          bits, bitsBefore, bitsAfter, shiftThatWorked)
-        if status:
-          foundEmptyFrame, hexBlocks = block0ThoroughCheck(hexBlocks)
-          if foundEmptyFrame:
-            return True, hexBlocks, hexErrs
-          continue
+    # A block we have seen before is cheap to check, so do this first.
+    if block_cache:
+      hexBlocks[block], errs = blockCacheMatch(bits)
+      if hexBlocks[block] is not None:
+        hexErrs[block] = errs
+        packetStrategies.append('cache')
+
+        foundEmptyFrame, hexBlocks = block0ThoroughCheck(hexBlocks)
+        if foundEmptyFrame:
+          return True, hexBlocks, hexErrs
+        continue
+
+    # Extra checks: block zero tricks (block 0 only), blocks with
+    # trailing zeros, and learned constant bits. These are left for the
+    # deep decode.
+    strategies = []
+    if (block == 0) and (replace_f6b or block_zero_fixed_bits or \
+        f6b_auto_file) and not fast_pass:
+      strategies.append('bzt')
+    if fix_trailing_zeros and not fast_pass:
+      strategies.append('ftz')
+    if learn_priors and not fast_pass:
+      strategies.append('prior')
+
+    for strategy in orderStrategies(strategies):
+      if budgetExhausted():
+        break
+
+      startTime = time.perf_counter()
+
+      if strategy == 'bzt':
+        status, hexBlocks, hexErrs[block] = blockZeroTricks(bits, \
+            bitsBefore, bitsAfter, hexBlocks, timeStr)
+      elif strategy == 'prior':
+        forced = priorMask(timeStr, block)
+        if forced is not None:
+          status, hexBlocks[block], hexErrs[block], shift = \
+            tryShiftBits(rsFisb, bits, bitsBefore, bitsAfter, \
+            shiftThatWorked, forced=forced)
+          if status:
+            shiftWorked(shift)
+      else:
+        foundAnyZeros, zeroBits = fixZeros(np.copy(bits))
+        if foundAnyZeros:
+          status, hexBlocks[block], hexErrs[block], shift = \
+            tryShiftBits(rsFisb, zeroBits, bitsBefore, bitsAfter, \
+            shiftThatWorked)
+          if status:
+            shiftWorked(shift)
+
+      recordStrategy(strategy, status, startTime)
+
+      if status:
+        break
+
+    if status:
+      foundEmptyFrame, hexBlocks = block0ThoroughCheck(hexBlocks)
+      if foundEmptyFrame:
+        return True, hexBlocks, hexErrs
+      continue
 
     # There are still blocks with errors
 
@@ -853,7 +1891,7 @@ def fisbDecode(samples, offset, hexBlocks, hexErrs):
   # Otherwise, all blocks were error corrected.
   return True, hexBlocks, hexErrs
 
-def adsbDecode(samples, offset, isShort):
+def adsbDecode(samples, offset, isShort, forced = None):
   """
   Given a ADS-B raw message, attempt to error correct all blocks.
 
@@ -885,25 +1923,40 @@ def adsbDecode(samples, offset, isShort):
     offset, isShort)
   
   # Shift bits
-  status, hexBlock, errs, _ = tryShiftBits(rs, bits, bitsBefore, bitsAfter, -1)
+  status, hexBlock, errs, shift = tryShiftBits(rs, bits, bitsBefore, \
+      bitsAfter, firstShift, forced=forced)
 
-  if status:
-    # These don't always decode correctly. Make sure that short messages are 
-    # always payload type 0 or 12, and long messages are always payload types
-    # 1 to 14 (excluding 12).
-    # Also make sure the length of the hex string matches the payload type.
-    hexBlockLen = len(hexBlock)
-    byte0 = bytes.fromhex(hexBlock[0:2])[0]
-    payloadTypeCode = (byte0 & 0xF8) >> 3
-
-    if (payloadTypeCode in [0, 12]) and (hexBlockLen == 36):
-      return True, hexBlock, errs
-    elif payloadTypeCode in [1,2,3,4,5,6,11,13,14] \
-        and (hexBlockLen == 68):
-      return True, hexBlock, errs
+  if status and adsbPayloadTypeValid(hexBlock):
+    shiftWorked(shift)
+    return True, hexBlock, errs
 
   return False, None, 98
 
+def adsbPayloadTypeValid(hexBlock):
+  """
+  Error corrected ADS-B messages don't always decode correctly. Make sure
+  that short messages are always payload type 0 or 12, and long messages
+  are always payload types 1 to 14 (excluding 12).
+
+  Args:
+    hexBlock (str): Error corrected ADS-B message as a hex string.
+
+  Returns:
+    bool: ``True`` if the length of the hex string matches the payload
+    type.
+  """
+  hexBlockLen = len(hexBlock)
+  byte0 = bytes.fromhex(hexBlock[0:2])[0]
+  payloadTypeCode = (byte0 & 0xF8) >> 3
+
+  if (payloadTypeCode in [0, 12]) and (hexBlockLen == 36):
+    return True
+  elif payloadTypeCode in [1,2,3,4,5,6,11,13,14] \
+      and (hexBlockLen == 68):
+    return True
+
+  return False
+
 def fisbHexErrsToStr(hexErrs):
   """
   Given an list containing error entries for each FIS-B block, return a
@@ -975,8 +2028,24 @@ def fisbTimingDecode(hexBlock0, timeStr):
 
   xmtDelay = int((msPartOfTimeStr * 1000) - xmtMs)
 
+  dataChannel = fisbDataChannel(slotId, timeStrAsFloat)
+
+  return f'/{slotId+1}:{mso}:{xmtMs}/{xmtDelay}/{tisbSiteId}/{dataChannel}'
+
+def fisbDataChannel(slotId, timeValue):
+  """
+  Find the data channel a FIS-B packet was sent on. Data channels are
+  rotated through the slots every second.
+
+  Args:
+    slotId (int): Slot id (0-31) from block 0.
+    timeValue (float): Epoch UTC time the message arrived.
+
+  Returns:
+    int: Data channel (1-32).
+  """
   # Get time in seconds past midnight (for data channel determination)
-  packetTime = datetime.fromtimestamp(timeStrAsFloat, tz=timezone.utc)
+  packetTime = datetime.fromtimestamp(timeValue, tz=timezone.utc)
   secsPastMidnightMod32 = int((packetTime - packetTime.replace(hour=0, \
           minute=0, second=0)).total_seconds()) % 32
 
@@ -984,10 +2053,172 @@ def fisbTimingDecode(hexBlock0, timeStr):
 
   if dataChannel0Based < 0:
     dataChannel0Based += 32
-            
-  dataChannel = dataChannel0Based + 1
 
-  return f'/{slotId+1}:{mso}:{xmtMs}/{xmtDelay}/{tisbSiteId}/{dataChannel}'
+  return dataChannel0Based + 1
+
+def slotDelayLearn(hexBlock0, timeStr):
+  """
+  Track the delay between the start of a decoded FIS-B packet's slot
+  and its arrival time, so ``expectedDataChannel()`` can tell the slot
+  of a packet before it is decoded.
+
+  Args:
+    hexBlock0 (str): Hex string of decoded block 0.
+    timeStr (str): Epoch UTC time the message arrived.
+
+  Returns:
+    int: Data channel (1-32) of the packet.
+  """
+  global slotDelay, slotDelayDev
+
+  slotId = int(hexBlock0[12:14], 16) & 0x1f
+  timeValue = float(timeStr)
+
+  # Delay from the start of the slot, kept within +/- 500 ms since a
+  # late packet in slot 31 arrives in the next second.
+  delay = ((timeValue % 1.0) * 1000) - (6 + (slotId * 5.5))
+  delay = ((delay + 500) % 1000) - 500
+
+  with learnLock:
+    if slotDelay is None:
+      slotDelay = delay
+      slotDelayDev = SLOT_DELAY_DEV_MAX
+    else:
+      err = delay - slotDelay
+      slotDelay += err / 16
+      slotDelayDev += (abs(err) - slotDelayDev) / 16
+
+  return fisbDataChannel(slotId, timeValue)
+
+def expectedDataChannel(timeStr):
+  """
+  Work out the data channel a FIS-B packet was sent on from its arrival
+  time, using the delay tracked by ``slotDelayLearn()``. This is only
+  done if the delay is steady, which it isn't when playing back a file.
+
+  Args:
+    timeStr (str): Epoch UTC time the message arrived.
+
+  Returns:
+    int: Data channel (1-32), or ``None`` if it can't be told.
+  """
+  with learnLock:
+    if (slotDelay is None) or (slotDelayDev >= SLOT_DELAY_DEV_MAX):
+      return None
+
+    # Time at the start of the slot.
+    slotTime = float(timeStr) - (slotDelay / 1000)
+
+  slotId = round(((slotTime % 1.0) * 1000 - 6) / 5.5) % 32
+  return fisbDataChannel(slotId, slotTime)
+
+def f6bLearn(hexBlock0, dataChannel):
+  """
+  Learn the first 6 bytes (ground station latitude and longitude) of a
+  decoded FIS-B block 0 for ``--f6bauto``. The value is counted against
+  the packet's data channel, which stays the same for a station.
+
+  Args:
+    hexBlock0 (str): Hex string of decoded block 0.
+    dataChannel (int): Data channel (1-32) of the packet.
+  """
+  with learnLock:
+    counts = f6bLearned.setdefault(dataChannel, {})
+    counts[hexBlock0[0:12]] = counts.get(hexBlock0[0:12], 0) + 1
+
+    if counts[hexBlock0[0:12]] >= F6B_COUNT_MAX:
+      for x in list(counts):
+        counts[x] //= 2
+        if counts[x] == 0:
+          del counts[x]
+
+    if len(counts) > F6B_PER_CHANNEL:
+      del counts[min(counts, key=counts.get)]
+
+def f6bCandidates(timeStr):
+  """
+  Get the values to force the first 6 bytes of block 0 to.
+
+  These are the ``--f6b`` values, then (with ``--f6bauto``) the most
+  decoded learned values for the data channel we expect this packet was
+  sent on (see ``expectedDataChannel()``), then the most decoded learned
+  values overall. No more than ``F6B_TRY`` learned values are tried.
+
+  Args:
+    timeStr (str): Epoch UTC time the message arrived.
+
+  Returns:
+    nparray: Array of shape (n, 6) of uint8 values, or ``None``.
+  """
+  if f6b_auto_file is None:
+    return f6bArray[0:f6bArrayLen] if replace_f6b else None
+
+  f6bList = []
+  if replace_f6b:
+    f6bList = [x.tobytes().hex() for x in f6bArray[0:f6bArrayLen]]
+
+  dataChannel = expectedDataChannel(timeStr)
+
+  learned = []
+  with learnLock:
+    if dataChannel is not None:
+      counts = f6bLearned.get(dataChannel, {})
+      learned = sorted(counts, key=counts.get, reverse=True)
+
+    totals = {}
+    for counts in f6bLearned.values():
+      for x in counts:
+        totals[x] = totals.get(x, 0) + counts[x]
+
+  learned += sorted(totals, key=totals.get, reverse=True)
+
+  numLearned = 0
+  for x in learned:
+    if numLearned == F6B_TRY:
+      break
+    if x not in f6bList:
+      f6bList.append(x)
+      numLearned += 1
+
+  if len(f6bList) == 0:
+    return None
+
+  return parseF6b(' '.join(f6bList))
+
+def f6bLoad(path):
+  """
+  Load the learned first 6 byte values saved by ``f6bSave()``. A
+  missing file is not an error, since we will learn them.
+
+  Args:
+    path (str): File to load.
+  """
+  try:
+    with open(path, 'r') as f:
+      for line in f:
+        words = line.split()
+        if len(words) == 3:
+          f6bLearned.setdefault(int(words[0]), {})[words[1]] = int(words[2])
+  except FileNotFoundError:
+    pass
+
+def f6bSave(path):
+  """
+  Save the learned first 6 byte values. Each line has the data channel,
+  the hex value and its count. Written to a temporary file first so a
+  crash can't leave a partial file.
+
+  Args:
+    path (str): File to save to.
+  """
+  with learnLock:
+    lines = [f'{ch} {x} {counts[x]}\n' for ch, counts in \
+        sorted(f6bLearned.items()) for x in counts]
+
+  tmpPath = path + '.tmp'
+  with open(tmpPath, 'w') as f:
+    f.writelines(lines)
+  os.replace(tmpPath, path)
   
 def fisbHexBlocksFormatted(hexBlocks, signalStrengthStr, timeStr, hexErrs, \
    syncErrors):
@@ -1181,6 +2412,107 @@ def adsbMiniDecode(hexBlock, timeStr):
 
   return decodeStr
 
+def adsbState(hexBlock):
+  """
+  Decode the parts of the ADS-B state vector (and mode status, if
+  present) we track for each aircraft.
+
+  Args:
+    hexBlock (str): String of hex characters representing the ADS-B message.
+
+  Returns:
+    dict: Dictionary with:
+
+    * 'alt': Coded altitude (25 foot steps, 0 if not known).
+    * 'ag': Air/ground state (0-3).
+    * 'lat', 'lon': Position in degrees, or ``None`` if not known.
+    * 'cs': Emitter category and call sign (see ``decodeCallSign()``),
+      or ``None`` if this payload type has no mode status.
+  """
+  adsbBytes = bytes.fromhex(hexBlock)
+  payloadTypeCode = (adsbBytes[0] & 0xF8) >> 3
+
+  rawLat = (adsbBytes[4] << 15) | (adsbBytes[5] << 7) | (adsbBytes[6] >> 1)
+  rawLon = ((adsbBytes[6] & 0x01) << 23) | (adsbBytes[7] << 15) | \
+      (adsbBytes[8] << 7) | (adsbBytes[9] >> 1)
+
+  lat, lon = None, None
+  if (rawLat != 0) or (rawLon != 0):
+    lat = rawLat * 360.0 / 16777216.0
+    if lat > 90:
+      lat -= 180
+
+    lon = rawLon * 360.0 / 16777216.0
+    if lon > 180:
+      lon -= 360
+
+  callSign = None
+  if (payloadTypeCode in [1, 3]) and (len(adsbBytes) >= 23):
+    callSign = decodeCallSign(adsbBytes[17:23])
+
+  return {'alt': (adsbBytes[10] << 4) | (adsbBytes[11] >> 4), \
+      'ag': (adsbBytes[12] >> 6) & 0x03, 'lat': lat, 'lon': lon, \
+      'cs': callSign}
+
+def aircraftUpdate(hexBlock, timeStr):
+  """
+  Update the aircraft table with an ADS-B message and decide if it
+  should be sent (``--adsbrate``).
+
+  A message is sent for a new aircraft, if the air/ground state or call
+  sign changed, if the altitude changed by ``AIRCRAFT_ALT_CHANGE`` since
+  the last message sent, or if ``adsb_rate`` seconds have passed since
+  the last message sent.
+
+  Each aircraft has the state of the last message heard ('alt', 'ag',
+  'lat', 'lon', 'cs', see ``adsbState()``), when it was last heard
+  ('heard'), and when ('sent') and at what altitude ('sentAlt') a
+  message was last sent.
+
+  Args:
+    hexBlock (str): String of hex characters representing the ADS-B message.
+    timeStr (str): Epoch UTC time the message arrived.
+
+  Returns:
+    bool: ``True`` if the message should be sent.
+  """
+  timeValue = float(timeStr)
+  key = int(hexBlock[0:8], 16) & 0x07ffffff
+  state = adsbState(hexBlock)
+
+  with learnLock:
+    entry = aircraft.pop(key, None)
+
+    if entry is None:
+      entry = {'sent': None, 'sentAlt': state['alt'], 'ag': state['ag'], \
+          'cs': None}
+
+    # Keep the last call sign if this message doesn't have one.
+    if state['cs'] is None:
+      state['cs'] = entry['cs']
+
+    send = (entry['sent'] is None) or (entry['ag'] != state['ag']) or \
+        (entry['cs'] != state['cs']) or \
+        (abs(entry['sentAlt'] - state['alt']) * 25 >= AIRCRAFT_ALT_CHANGE) or \
+        ((timeValue - entry['sent']) >= adsb_rate)
+
+    entry.update(state)
+    entry['heard'] = timeValue
+
+    if send:
+      entry['sent'] = timeValue
+      entry['sentAlt'] = state['alt']
+
+    aircraft[key] = entry
+
+    # Drop aircraft not heard in a while (oldest are first).
+    while (len(aircraft) > 0) and \
+        ((timeValue - next(iter(aircraft.values()))['heard']) > \
+        AIRCRAFT_MAX_AGE):
+      del aircraft[next(iter(aircraft))]
+
+  return send
+
 def adsbHexBlockFormatted(hexBlock, signalStrengthStr, timeStr, errs, \
     syncErrors):
   """
@@ -1299,15 +2631,18 @@ def fisbProcessPacket(samples, timeStr, signalStrengthStr, syncErrors, \
 
   # Start with simple sample error correction. This works most of the time.
   didErrCorrect, hexBlocks, hexErrs = fisbDecode(samples, offset, None, \
-      None)
+      None, timeStr)
 
   if didErrCorrect:
     return didErrCorrect, fisbHexBlocksFormatted(hexBlocks, \
       signalStrengthStr, timeStr, hexErrs, syncErrors)
 
   # Try with added offset
-  didErrCorrect, hexBlocks, hexErrs = fisbDecode(samples, offset + 1, \
-      hexBlocks, hexErrs)
+  if not (fast_pass or budgetExhausted()):
+    startTime = time.perf_counter()
+    didErrCorrect, hexBlocks, hexErrs = fisbDecode(samples, offset + 1, \
+        hexBlocks, hexErrs, timeStr)
+    recordStrategy('offset2', didErrCorrect, startTime)
 
   if didErrCorrect:
     # Return formatted string (add 500 to num tries if we needed an offset)
@@ -1317,7 +2652,9 @@ def fisbProcessPacket(samples, timeStr, signalStrengthStr, syncErrors, \
   # Did not error correct.
   hexErrsStr = fisbHexErrsToStr(hexErrs)
 
-  if show_failed_fisb and (output_d978 == False) and (output_d978fa == False):
+  # After a fast pass the deep decode has the final say.
+  if show_failed_fisb and (output_d978 == False) and (output_d978fa == False) \
+      and not fast_pass:
 
     failStr = f'#FAILED-FIS-B {syncErrors}/{hexErrsStr} ss={signalStrengthStr}' + \
       f' t={timeStr} {attrStr}'
@@ -1360,12 +2697,16 @@ def adsbProcessPacket(samples, timeStr, signalStrengthStr, syncErrors, \
   # Starting offset is 1. This is where tha actual sample data begins.
   offset = 1
 
+  # demod_978 -s sends packets it is sure are short as 'S'. The samples
+  # for a long message aren't there (just zeros), so only short is tried.
+  knownShort = (attrStr.split('.')[2] == 'S')
+
   # Try to guess if this is a short message (1st 5 bits 0 or 12). We will try both
   # ways, but try to start with the most likely candidate.
   isShort = False #assume long
   first5Bits = (samples[1] << 4) | (samples[3] << 3) | (samples[5] << 2) | \
       (samples[7] << 1) | samples[9]
-  if first5Bits in [0, 12]:
+  if knownShort or (first5Bits in [0, 12]):
       isShort = True
   
   # Error corrections are sorted by the % of the time they match. I.e. we try the
@@ -1376,29 +2717,51 @@ def adsbProcessPacket(samples, timeStr, signalStrengthStr, syncErrors, \
   if didErrCorrect:
     return didErrCorrect, adsbHexBlockFormatted(hexBlock, signalStrengthStr, \
         timeStr, errs, syncErrors), isShort
-  
-  # opposite (we thought is was a long, but it was a short, or visa versa)
-  # 2.9%
-  didErrCorrect, hexBlock, errs = adsbDecode(samples, offset, not isShort)
-  if didErrCorrect:
-    return didErrCorrect, adsbHexBlockFormatted(hexBlock, signalStrengthStr, \
-        timeStr, errs, syncErrors), isShort
-  
-  # opposite offset (switch long for short (or visa versa) and add offset) 2.3%
-  didErrCorrect, hexBlock, errs = adsbDecode(samples, offset + 1, \
-      not isShort)
-  if didErrCorrect:
-    return didErrCorrect, adsbHexBlockFormatted(hexBlock, signalStrengthStr, \
-        timeStr, errs, syncErrors), isShort
 
-  # offset (take our original data and increase the offset) 0.4%
-  didErrCorrect, hexBlock, errs = adsbDecode(samples, offset + 1, isShort)
-  if didErrCorrect:
-    return didErrCorrect, adsbHexBlockFormatted(hexBlock, signalStrengthStr, \
-        timeStr, errs, syncErrors), isShort
+  # The rest are tried in this order unless there is a decode budget,
+  # in which case they are tried in order of yield.
+  #   opposite (we thought is was a long, but it was a short, or visa versa)
+  #     2.9%
+  #   opposite offset (switch long for short (or visa versa) and add offset)
+  #     2.3%
+  #   offset (take our original data and increase the offset) 0.4%
+  #   addr (force the address of a recently heard aircraft, --addr only)
+  attempts = {'opposite': (offset, not isShort), \
+      'oppoffset': (offset + 1, not isShort), \
+      'offset': (offset + 1, isShort)}
+
+  strategies = ['opposite', 'oppoffset', 'offset']
+  if adsb_address_priors:
+    strategies.append('addr')
+
+  # The fast pass only tries the other length, since our guess at the
+  # length is only a guess.
+  for strategy in orderStrategies(strategies):
+    if budgetExhausted():
+      break
+
+    if fast_pass and (strategy != 'opposite'):
+      continue
+
+    if knownShort and (strategy in ['opposite', 'oppoffset']):
+      continue
+
+    startTime = time.perf_counter()
+    if strategy == 'addr':
+      didErrCorrect, hexBlock, errs = adsbAddressDecode(samples, offset, \
+          isShort, timeStr, float(signalStrengthStr.split('/')[0]))
+    else:
+      didErrCorrect, hexBlock, errs = adsbDecode(samples, \
+          attempts[strategy][0], attempts[strategy][1])
+    recordStrategy(strategy, didErrCorrect, startTime)
+
+    if didErrCorrect:
+      return didErrCorrect, adsbHexBlockFormatted(hexBlock, signalStrengthStr, \
+          timeStr, errs, syncErrors), isShort
 
   # Did not error correct.
-  if show_failed_adsb and (output_d978 == False) and (output_d978fa == False):
+  if show_failed_adsb and (output_d978 == False) and (output_d978fa == False) \
+      and not fast_pass:
 
     failStr = f'#FAILED-ADS-B {syncErrors}/{errs} ss={signalStrengthStr}' + \
       f' t={timeStr} {attrStr}'
@@ -1408,198 +2771,1281 @@ def adsbProcessPacket(samples, timeStr, signalStrengthStr, syncErrors, \
 
   return False, None, isShort
 
-def main():
+def parseF6b(hexStrs):
   """
-  Process raw FIS-B and ADS-B (short and long) demodulated samples from
-  standard input (usually from ``demod_978``).
+  Convert the list of first 6 byte hex strings used by ``--f6b`` to
+  an array.
 
-  We read a fixed length attribute string containing information
-  about the packet to follow. Then we read the packet and process it.
+  Args:
+    hexStrs (str): One or more 12 character hex strings separated
+      by whitespace.
 
-  Rinse and repeat.
+  Returns:
+    nparray: Array of shape (n, 6) of uint8 values.
 
-  Output is sent to standard output. If indicated (``-se``), errors 
-  can be saved seperately in files.
+  Raises:
+    ValueError: If any string isn't hex, or isn't 12 characters long.
   """
-  # Lowest signal level found for FIS-B and ADS-B.
-  # These start out as higher than we will ever see.
-  lowest_adsbs_level = 1000000000
-  lowest_adsbl_level = 1000000000
-  lowest_fisb_level = 1000000000
+  hexStrList = hexStrs.split()
   
-  try:
-    while True:
-      # We alternate reading attributes and packets
+  arr = np.zeros((len(hexStrList), 6), dtype=np.uint8)
 
-      # Read attributes
-      attributes = sys.stdin.buffer.read(ATTRIBUTE_LEN)
+  for i, hexstr in enumerate(hexStrList):
+    # Catch non-hex values
+    try:
+      int(hexstr, 16)
+    except ValueError:
+      raise ValueError('Illegal hex for --f6b')
 
-      # Convert from bytes to string for parsing.
-      attrStr = "".join(chr(x) for x in attributes)
+    # Length has to be 12
+    if (len(hexstr) != 12):
+      raise ValueError('Hex string length must be 12')
 
-      # Exit if nothing more to read (should only happen when
-      # reading from file).
-      if attrStr == '':
-        break
+    # Convert hex to array.
+    for j in range(0, 6):
+      arr[i][j] = int(hexstr[j*2:(j*2)+2], 16)
 
-      splitName = attrStr.split(".")
+  return arr
 
-      # Create time string and signal strength string from the
-      # file components.
-      timeStr = splitName[0] + '.' + splitName[1][0:3]
-      rawSignalStrength = round(int(splitName[3]) / 1000000.0, 2)
-            
-      # Extract sync errors
-      syncErrors = splitName[4]
+def controlCommand(line):
+  """
+  Carry out a single control socket command and return the reply.
+
+  Commands are:
+
+  * ``get``: Show current settings (and learned ``--f6bauto`` values).
+  * ``stats``: Show packet counts.
+  * ``stations``: Show the ``--report`` station report so far.
+  * ``aircraft``: Show the ``--adsbrate`` aircraft table, one aircraft a
+    line: qualifier.address, seconds since heard, altitude, air/ground
+    state, latitude, longitude and call sign.
+  * ``set <name> on|off``: Turn a setting on or off. Names are the
+    flag names without dashes: ``ff``, ``fa``, ``ll``, ``bzfb``,
+    ``ftz``, ``apd``, ``fet``, ``saveraw``.
+  * ``set f6b <hex> [<hex> ...]``: Replace the ``--f6b`` values.
+    ``set f6b off`` stops using them.
+  * ``help``: List commands.
 
-      # Extract rssi
-      rssi = float(splitName[5]) / 10.0
-      signalStrengthString = str(rawSignalStrength) + '/' + str(rssi)
+  Args:
+    line (str): Command line without the newline.
 
-      # Detect if this an a FIS-B packet ('F') or ADS-B packet ('A').
-      if (splitName[2] == 'F'):
-        isFisbPacket = True
-        packetLength = PACKET_LENGTH_FISB
-      else:
-        isFisbPacket = False
-        packetLength = PACKET_LENGTH_ADSB
+  Returns:
+    str: Reply lines. The last line is always ``ok`` or
+    ``error <reason>``.
+  """
+  global replace_f6b, f6bArray, f6bArrayLen
 
-      # Read packet as a set of bytes
-      packetBuf = sys.stdin.buffer.read(packetLength)
+  words = line.split()
+  if len(words) == 0:
+    return ''
 
-      # Save to file if we are saving data for further study.
-      if save_raw_data_to_disk:
-        with open(timeStr + '.' + splitName[2] + '.i32', 'wb') as bfile:
-          bfile.write(packetBuf)
+  if words[0] == 'get':
+    reply = ''
+    for name, var in CONTROL_SETTINGS.items():
+      reply += f'{name} {"on" if globals()[var] else "off"}\n'
 
-      # Numpy will convert the bytes to int32's
-      packet = np.frombuffer(packetBuf, np.int32)
+    if replace_f6b:
+      reply += 'f6b ' + ' '.join(x.tobytes().hex() for x in \
+          f6bArray[0:f6bArrayLen]) + '\n'
+    else:
+      reply += 'f6b off\n'
+
+    # Learned 1st 6 byte values as '<data channel>:<hex>:<count>'.
+    if f6b_auto_file is not None:
+      with learnLock:
+        reply += 'f6bauto' + ''.join(f' {ch}:{x}:{counts[x]}' for ch, \
+            counts in sorted(f6bLearned.items()) for x in counts) + '\n'
+    return reply + 'ok\n'
+
+  if words[0] == 'stats':
+    reply = ''
+    for name, val in stats.items():
+      reply += f'{name} {val}\n'
+    return reply + 'ok\n'
+
+  if words[0] == 'stations':
+    with learnLock:
+      endTime = max([x['last'] for x in stationStats.values()], default=0)
+    return stationReport(endTime) + 'ok\n'
+
+  if words[0] == 'aircraft':
+    reply = ''
+    with learnLock:
+      newest = max([x['heard'] for x in aircraft.values()], default=0)
+      for key, x in aircraft.items():
+        altitude = '?' if x['alt'] in [0, 4095] else (x['alt'] - 41) * 25
+        position = '? ?' if x['lat'] is None else \
+            f'{x["lat"]:.4f} {x["lon"]:.4f}'
+        reply += f'{key >> 24}.{key & 0xffffff:06X} ' + \
+            f'{newest - x["heard"]:.0f} {altitude} {x["ag"]} {position} ' + \
+            f'{x["cs"][1:].strip() if x["cs"] else "?"}\n'
+    return reply + 'ok\n'
+
+  if words[0] == 'help':
+    return 'get\nstats\nstations\naircraft\nset <name> on|off\n' + \
+        'set f6b <hex> ...|off\nok\n'
+
+  if (words[0] != 'set') or (len(words) < 3):
+    return 'error unknown command\n'
+
+  if words[1] == 'f6b':
+    if words[2] == 'off':
+      replace_f6b = False
+      return 'ok\n'
+
+    try:
+      newArray = parseF6b(' '.join(words[2:]))
+    except ValueError as e:
+      return f'error {e}\n'
+
+    # The decode loop may be reading these. Make sure the length
+    # never exceeds the array.
+    f6bArrayLen = 0
+    f6bArray = newArray
+    f6bArrayLen = len(newArray)
+    replace_f6b = True
+    return 'ok\n'
 
-      if isFisbPacket:
-        didErrCorrect, resultStr = fisbProcessPacket(packet, timeStr, \
-          signalStrengthString, syncErrors, attrStr)
-      else:
-        didErrCorrect, resultStr, isShort = adsbProcessPacket(packet, timeStr, \
-          signalStrengthString, syncErrors, attrStr)
+  if words[1] not in CONTROL_SETTINGS:
+    return 'error unknown setting\n'
 
-      if didErrCorrect:
-        # If printing lowest levels, print to stderr if this is the
-        # lowest so far (for ADS-B and FIS-B independently).
-        if show_lowest_levels:
-          if isFisbPacket:
-            if rawSignalStrength < lowest_fisb_level:
-              lowest_fisb_level = rawSignalStrength
-              print(f'lowest FIS-B     signal: {lowest_fisb_level}', \
-                  flush=True, file=sys.stderr)
-          else:
-            if isShort:
-              if rawSignalStrength < lowest_adsbs_level:
-                lowest_adsbs_level = rawSignalStrength
-                print(f'lowest ADS-B (S) signal: {lowest_adsbs_level}', \
-                    flush=True, file=sys.stderr)
-            else:
-              if rawSignalStrength < lowest_adsbl_level:
-                lowest_adsbl_level = rawSignalStrength
-                print(f'lowest ADS-B (L) signal: {lowest_adsbl_level}', \
-                    flush=True, file=sys.stderr)
-
-
-        # Edit result if we need to be compatible with dump978 or dump978-fa
-        if output_d978fa or output_d978:
-          resultStr = fixupResultForD978(resultStr, output_d978fa)
-
-        # Write to standard output.
-        print(resultStr, flush=True)
-
-      # Write error file only if we are printing an error string.
-      # This lets us specify which error files to save.
-      elif writingErrorFiles and \
-          ((isFisbPacket and show_failed_fisb) or \
-           ((not isFisbPacket) and show_failed_adsb)):
-
-        # For a failed FIS-B packet, resultStr is a string of 
-        # Reed-Solomon errors for each block. Add this to the
-        # filename. This doesn't make sense for ADB-B packets
-        # because the error count is always '99'.
-        hexErrStr = ''
-        if resultStr is not None:
-          hexErrStr = '.' + resultStr
-
-        # Write file to error directory.
-        errPath = os.path.join(dir_out_errors, attrStr + hexErrStr + '.i32')
-        with open(errPath, 'wb') as errFile:
-          errFile.write(packetBuf)
+  if words[2] not in ['on', 'off']:
+    return 'error value must be on or off\n'
 
-  except KeyboardInterrupt:
-    sys.exit(0)
+  globals()[CONTROL_SETTINGS[words[1]]] = (words[2] == 'on')
+  return 'ok\n'
 
-def mainReprocessErrors(errorDir):
+class ControlHandler(socketserver.StreamRequestHandler):
   """
-  Reprocess any errors from the specified error directory
-  (called when ``-re`` argument is given).
+  Handle a single control socket connection. Each line received
+  is passed to ``controlCommand()`` and the reply sent back.
+  """
+  def handle(self):
+    for line in self.rfile:
+      reply = controlCommand(line.decode(errors='replace'))
+      self.wfile.write(reply.encode())
 
-  This option will reprocess any errors that are in the
-  error directory. This is used to study particular messages
-  and create improved techniques for decoding.
+def startControlServer(port):
+  """
+  Start the control socket on 127.0.0.1 in a background thread.
 
-  It does not delete any files in the directory and only
-  one pass is made through the directory.
+  Args:
+    port (int): TCP port to listen on.
+  """
+  socketserver.ThreadingTCPServer.allow_reuse_address = True
+  server = socketserver.ThreadingTCPServer(('127.0.0.1', port), \
+      ControlHandler)
+  server.daemon_threads = True
 
-  If any message cannot be error corrected, it is not written to
-  any error directory (even if specified).
+  thread = threading.Thread(target=server.serve_forever, daemon=True)
+  thread.start()
 
-  It will always print FIS-B and ADS-B errors.
+def parseAttributes(attrStr):
+  """
+  Split the attribute string sent before each packet into the values
+  we use.
 
   Args:
-    errorDir (str): Directory where the error files are.
-  """
-  errFiles = glob.glob(os.path.join(errorDir, '*.i32'))
+    attrStr (str): Attribute string (``ATTRIBUTE_LEN`` characters).
 
-  for filen in errFiles:
-    # find last index of '/'
-    lastSlash = filen.rfind('/')
+  Returns:
+    tuple: Tuple containing:
 
-    attrStr = filen[lastSlash + 1:]
+    * Time string (epoch seconds with milliseconds).
+    * Raw signal strength (float).
+    * Signal strength string (raw signal strength and rssi).
+    * Sync errors (str).
+    * ``True`` if this is a FIS-B packet, ``False`` if ADS-B.
+  """
+  splitName = attrStr.split(".")
 
-    splitName = attrStr.split(".")
+  # Create time string and signal strength string from the
+  # file components.
+  timeStr = splitName[0] + '.' + splitName[1][0:3]
+  rawSignalStrength = round(int(splitName[3]) / 1000000.0, 2)
 
-    # Create time string and signal strength string from the
-    # file components.
-    timeStr = splitName[0] + '.' + splitName[1][0:3]
-    signalStrengthString = str(round(int(splitName[3]) \
-        / 1000000.0, 2))
-      
-    # Extract sync errors
-    syncErrors = splitName[4]
+  # Extract sync errors
+  syncErrors = splitName[4]
 
-    # Detect if this an a FIS-B packet ('F') or ADS-B packet ('A').
-    if (splitName[2] == 'F'):
-      isFisbPacket = True
-      packetLength = PACKET_LENGTH_FISB
-    else:
-      isFisbPacket = False
-      packetLength = PACKET_LENGTH_ADSB
+  # Extract rssi
+  rssi = float(splitName[5]) / 10.0
+  signalStrengthString = str(rawSignalStrength) + '/' + str(rssi)
 
-    with open(filen, 'rb') as filePtr:
-       # Read packet as a set of bytes
-      packetBuf = filePtr.read(packetLength)
+  # Detect if this an a FIS-B packet ('F') or ADS-B packet ('A').
+  isFisbPacket = (splitName[2] == 'F')
 
-    # Numpy will convert the bytes to int32's
-    packet = np.frombuffer(packetBuf, np.int32)
+  return timeStr, rawSignalStrength, signalStrengthString, syncErrors, \
+      isFisbPacket
 
-    if isFisbPacket:
-      didErrCorrect, resultStr = fisbProcessPacket(packet, timeStr, \
-        signalStrengthString, syncErrors, attrStr)
-    else:
-      didErrCorrect, resultStr, _ = adsbProcessPacket(packet, timeStr, \
-        signalStrengthString, syncErrors, attrStr)
+def decodePacket(packet, attrStr):
+  """
+  Error correct a packet of either type.
 
-    if didErrCorrect:
-      # Write to standard output.
-      print(resultStr, flush=True)
+  Args:
+    packet (nparray): Int 32 array of packet samples.
+    attrStr (str): Attribute string sent with the packet.
 
-# Call main function
-if __name__ == "__main__":
+  Returns:
+    tuple: Tuple containing:
+
+    * ``True`` if there was a successful error correction, else ``False``.
+    * Result string from ``fisbProcessPacket()`` or ``adsbProcessPacket()``.
+    * ``True`` if an ADS-B short message (always ``False`` for FIS-B).
+  """
+  global packetStrategies
+
+  timeStr, rawSignalStrength, signalStrengthString, syncErrors, \
+      isFisbPacket = parseAttributes(attrStr)
+
+  packetStrategies = []
+
+  setShiftOrder(timeStr, rawSignalStrength, isFisbPacket)
+
+  if isFisbPacket:
+    didErrCorrect, resultStr = fisbProcessPacket(packet, timeStr, \
+      signalStrengthString, syncErrors, attrStr)
+    isShort = False
+  else:
+    didErrCorrect, resultStr, isShort = adsbProcessPacket(packet, timeStr, \
+        signalStrengthString, syncErrors, attrStr)
+
+  # Remember the last shift that worked for the station (--adapt).
+  if didErrCorrect and (winningShift != -1):
+    lastShift[shiftKey] = winningShift
+
+    if isFisbPacket:
+      slotId = int(resultStr[13:15], 16) & 0x1f
+      lastShift[('F', fisbDataChannel(slotId, float(timeStr)))] = \
+          winningShift
+
+  return didErrCorrect, resultStr, isShort
+
+def stationCount(attrStr, didErrCorrect, resultStr, strategies):
+  """
+  Count a FIS-B packet's final result for the station report
+  (``--report``).
+
+  Decoded packets are counted against their data channel. Failed ones
+  are counted against the data channel expected from their arrival time
+  (see ``expectedDataChannel()``), or channel 0 if it can't be told.
+
+  Each data channel has 'first' and 'last' (packet times), 'decoded',
+  'failed', 'levelSum' (signal level of all packets), 'station' (hex of
+  the first 6 bytes of block 0), 'site' (TIS-B site id), and
+  'strategies' (number of packets each strategy helped decode, 'normal'
+  if none were needed).
+
+  Args:
+    attrStr (str): Attribute string sent with the packet.
+    didErrCorrect (bool): ``True`` if the packet was decoded.
+    resultStr (str): Result string ('+' then 6 blocks of hex) if decoded.
+    strategies (list): Strategies that decoded parts of the packet.
+  """
+  global stationReportStart
+
+  timeStr, rawSignalStrength, _, _, isFisbPacket = parseAttributes(attrStr)
+  if not isFisbPacket:
+    return
+
+  timeValue = float(timeStr)
+
+  if didErrCorrect:
+    slotId = int(resultStr[13:15], 16) & 0x1f
+    dataChannel = fisbDataChannel(slotId, timeValue)
+  else:
+    dataChannel = expectedDataChannel(timeStr)
+    if dataChannel is None:
+      dataChannel = 0
+
+  with learnLock:
+    if stationReportStart is None:
+      stationReportStart = timeValue
+
+    entry = stationStats.setdefault(dataChannel, {'first': timeValue, \
+        'last': timeValue, 'decoded': 0, 'failed': 0, 'levelSum': 0.0, \
+        'station': None, 'site': None, 'strategies': {}})
+
+    entry['first'] = min(entry['first'], timeValue)
+    entry['last'] = max(entry['last'], timeValue)
+    entry['levelSum'] += rawSignalStrength
+
+    if not didErrCorrect:
+      entry['failed'] += 1
+      return
+
+    entry['decoded'] += 1
+    entry['station'] = resultStr[1:13]
+    entry['site'] = int(resultStr[15:17], 16) >> 4
+
+    for name in set(strategies) if len(strategies) > 0 else ['normal']:
+      entry['strategies'][name] = entry['strategies'].get(name, 0) + 1
+
+def stationReport(endTime):
+  """
+  Make the station reception report for the packets counted since
+  ``stationReportStart``.
+
+  Each data channel (station) sends one packet a second, so a channel
+  should have a packet for each second from when it was first heard.
+  Packets we never saw at all are 'missed'. Channel 0 (failed packets
+  whose channel can't be told) has no expected count. Percent is
+  decoded over expected.
+
+  Args:
+    endTime (float): Packet time the report period ends.
+
+  Returns:
+    str: Report lines.
+  """
+  with learnLock:
+    items = sorted((x, dict(y)) for x, y in stationStats.items())
+    startTime = stationReportStart
+
+  if startTime is None:
+    return ''
+
+  report = f'station report {startTime:.0f}-{endTime:.0f} ' + \
+      f'({endTime - startTime:.0f} s)\n' + \
+      ' ch site station      expect decoded failed missed   pct level' + \
+      ' strategies\n'
+
+  for dataChannel, entry in items:
+    numPackets = entry['decoded'] + entry['failed']
+    meanLevel = entry['levelSum'] / numPackets
+    strategyStr = ' '.join(f'{x}:{y}' for x, y in \
+        sorted(entry['strategies'].items()))
+
+    if dataChannel == 0:
+      report += f'{0:>3} {"?":<4} {"?":<12} {"":>6} {0:>7} ' + \
+          f'{entry["failed"]:>6} {"":>6} {"":>5} {meanLevel:>5.1f}\n'
+      continue
+
+    expected = max(int(endTime - entry['first']) + 1, numPackets)
+    site = FISB_DATA_CHANNEL[dataChannel - 1]
+    percent = 100.0 * entry['decoded'] / expected
+
+    report += f'{dataChannel:>3} {site:<4} {entry["station"] or "?":<12} ' + \
+        f'{expected:>6} {entry["decoded"]:>7} {entry["failed"]:>6} ' + \
+        f'{expected - numPackets:>6} {percent:>5.1f} {meanLevel:>5.1f} ' + \
+        f'{strategyStr}\n'
+
+  return report
+
+def stationReportCheck(timeStr, final = False):
+  """
+  Write the station report to standard error if ``station_report``
+  seconds of packets have gone by, and start a new period.
+
+  Args:
+    timeStr (str): Epoch UTC time of the latest packet.
+    final (bool): ``True`` to write the report now (at exit).
+  """
+  global stationReportStart
+
+  timeValue = float(timeStr)
+
+  with learnLock:
+    if (stationReportStart is None) or ((not final) and \
+        (timeValue - stationReportStart < station_report)):
+      return
+
+  report = stationReport(timeValue)
+
+  with learnLock:
+    stationStats.clear()
+    stationReportStart = None
+
+  with outputLock:
+    print(report, end='', flush=True, file=sys.stderr)
+
+def emitResult(resultStr, attrStr, isShort, late = False):
+  """
+  Write an error corrected packet to standard output, and learn what
+  we can from it.
+
+  Args:
+    resultStr (str): Result string from ``decodePacket()``.
+    attrStr (str): Attribute string sent with the packet.
+    isShort (bool): ``True`` if ADS-B short message.
+    late (bool): ``True`` if decoded by the deep decode worker. Adds
+      ``;late`` to the end of the result (not for ``--d978`` or
+      ``--d978fa``, which have a strict format).
+
+  FIS-B packets whose frames were all sent recently are not written if
+  ``--dedup`` is set, or have ``;dup=`` added with ``--dupflag``.
+  """
+  timeStr, rawSignalStrength, _, _, isFisbPacket = parseAttributes(attrStr)
+
+  # Learn from block 0 ('+' then block 0 hex).
+  if isFisbPacket and ((f6b_auto_file is not None) or adapt_shifts or \
+      learn_priors):
+    dataChannel = slotDelayLearn(resultStr[1:1 + (72 * 2)], timeStr)
+
+    if f6b_auto_file is not None:
+      f6bLearn(resultStr[1:1 + (72 * 2)], dataChannel)
+
+    if learn_priors:
+      priorLearn(resultStr, dataChannel)
+
+  if isFisbPacket and block_cache:
+    blockCacheLearn(resultStr)
+
+  # Learn aircraft address ('-' then message hex).
+  if (not isFisbPacket) and adsb_address_priors:
+    addrLearn(resultStr[1:], timeStr, rawSignalStrength)
+
+  # Only send aircraft state changes, or every so often.
+  if (not isFisbPacket) and (adsb_rate is not None):
+    if not aircraftUpdate(resultStr[1:].split(';')[0], timeStr):
+      stats['adsb_limited'] += 1
+      return
+
+  # Drop packets with nothing new, or flag packets with duplicates.
+  # Packets with no frames are kept since they show the station is there.
+  dupStr = ''
+  if isFisbPacket and (dedup_window is not None):
+    dups, numFrames = fisbDuplicates(resultStr, timeStr)
+
+    if dedup_flag:
+      if dups > 0:
+        dupStr = f';dup={dups}/{numFrames}'
+    elif (numFrames > 0) and (dups == numFrames):
+      stats['dedup_dropped'] += 1
+      return
+
+  with outputLock:
+    # If printing lowest levels, print to stderr if this is the
+    # lowest so far (for ADS-B and FIS-B independently).
+    if show_lowest_levels:
+      if isFisbPacket:
+        key, name = 'fisb', 'FIS-B    '
+      elif isShort:
+        key, name = 'adsbs', 'ADS-B (S)'
+      else:
+        key, name = 'adsbl', 'ADS-B (L)'
+
+      if rawSignalStrength < lowestLevels[key]:
+        lowestLevels[key] = rawSignalStrength
+        print(f'lowest {name} signal: {rawSignalStrength}', \
+            flush=True, file=sys.stderr)
+
+    # Edit result if we need to be compatible with dump978 or dump978-fa
+    if output_d978fa or output_d978:
+      resultStr = fixupResultForD978(resultStr, output_d978fa)
+    else:
+      resultStr += dupStr
+
+      if late:
+        resultStr += ';late'
+
+    # Write to standard output.
+    print(resultStr, flush=True)
+
+def writeErrorFile(packetBuf, attrStr, resultStr, isFisbPacket):
+  """
+  Write a failed packet to the error directory if we are saving
+  error files and printing the error string for its type. This lets
+  us specify which error files to save.
+
+  Args:
+    packetBuf (bytes): Packet as read.
+    attrStr (str): Attribute string sent with the packet.
+    resultStr (str): Result string from ``decodePacket()``.
+    isFisbPacket (bool): ``True`` if FIS-B.
+  """
+  if not (writingErrorFiles and \
+      ((isFisbPacket and show_failed_fisb) or \
+       ((not isFisbPacket) and show_failed_adsb))):
+    return
+
+  # For a failed FIS-B packet, resultStr is a string of 
+  # Reed-Solomon errors for each block. Add this to the
+  # filename. This doesn't make sense for ADB-B packets
+  # because the error count is always '99'.
+  hexErrStr = ''
+  if resultStr is not None:
+    hexErrStr = '.' + resultStr
+
+  # Write file to error directory.
+  errPath = os.path.join(dir_out_errors, attrStr + hexErrStr + '.i32')
+  with open(errPath, 'wb') as errFile:
+    errFile.write(packetBuf)
+
+def deepSettings(timeStr):
+  """
+  Copy the ``DEEP_SETTINGS`` globals to send to the deep decode worker.
+  Learned values are copied since they can change before the job is
+  sent. Only the ``--priors`` counts for this packet's station are sent,
+  since they are large. For ``--cache``, only the blocks added since the
+  last job are sent.
+
+  Args:
+    timeStr (str): Epoch UTC time the message arrived.
+
+  Returns:
+    dict: Global name and value.
+  """
+  settings = {x: globals()[x] for x in DEEP_SETTINGS}
+
+  key = priorKey(timeStr) if learn_priors else None
+
+  with learnLock:
+    settings['f6bLearned'] = {ch: dict(counts) for ch, counts in \
+        f6bLearned.items()}
+    settings['slotDelay'] = slotDelay
+    settings['slotDelayDev'] = slotDelayDev
+
+    if block_cache:
+      settings['blockCacheNew'] = list(blockCacheNew)
+      blockCacheNew.clear()
+
+    if adsb_address_priors:
+      settings['addrTable'] = {x: list(y) for x, y in addrTable.items()}
+
+    settings['priorCounts'] = {}
+    if key in priorCounts:
+      settings['priorCounts'][key] = [priorCounts[key][0], \
+          np.copy(priorCounts[key][1])]
+
+  return settings
+
+def deepDecodeWorker(jobQueue, resultQueue):
+  """
+  Deep decode worker process (``--deep``). Runs at a lower priority and
+  tries everything on packets that failed the fast pass.
+
+  Jobs are ``(packetBuf, attrStr, settings, tag)`` where ``settings``
+  are the values of the ``DEEP_SETTINGS`` globals (``HUB_SETTINGS`` for
+  a hub) and ``tag`` is passed back (``None`` except for a hub).
+  Results are ``(attrStr, didErrCorrect, resultStr, isShort, tag)``.
+  ``None`` in the job queue ends the worker, which then puts ``None`` in
+  the result queue.
+
+  Failure strings (``--ff``, ``--fa``) and error files are written
+  here.
+
+  Args:
+    jobQueue (multiprocessing.Queue): Packets to decode.
+    resultQueue (multiprocessing.Queue): Results for
+      ``deepResultThread()``.
+  """
+  global fast_pass, decode_deadline, deep_decode
+
+  os.nice(DEEP_NICE)
+
+  # There is no hurry here.
+  fast_pass = False
+  decode_deadline = None
+
+  # We are the deep decode.
+  deep_decode = False
+
+  try:
+    while True:
+      job = jobQueue.get()
+      if job is None:
+        break
+
+      packetBuf, attrStr, settings, tag = job
+
+      with learnLock:
+        for hexBlock in settings.pop('blockCacheNew', []):
+          blockCacheAdd(hexBlock)
+
+      globals().update(settings)
+
+      didErrCorrect, resultStr, isShort = \
+          decodePacket(np.frombuffer(packetBuf, np.int32), attrStr)
+
+      isFisbPacket = parseAttributes(attrStr)[4]
+
+      if not didErrCorrect:
+        writeErrorFile(packetBuf, attrStr, resultStr, isFisbPacket)
+      elif isFisbPacket and block_cache:
+        # Don't wait for the main process to send these back.
+        blockCacheLearn(resultStr)
+
+      resultQueue.put((attrStr, didErrCorrect, resultStr, isShort, tag))
+  except KeyboardInterrupt:
+    pass
+
+  resultQueue.put(None)
+
+def deepResultThread(resultQueue):
+  """
+  Thread that writes late results from the deep decode worker, with
+  the time of the original packet.
+
+  Args:
+    resultQueue (multiprocessing.Queue): Results from
+      ``deepDecodeWorker()``.
+  """
+  while True:
+    result = resultQueue.get()
+    if result is None:
+      break
+
+    attrStr, didErrCorrect, resultStr, isShort, _ = result
+
+    if didErrCorrect:
+      stats['deep_decoded'] += 1
+
+    lateResult(attrStr, didErrCorrect, resultStr, isShort, 'deep')
+
+def lateResult(attrStr, didErrCorrect, resultStr, isShort, strategy):
+  """
+  Count and write a result from the deep decode worker or the hub.
+
+  Args:
+    attrStr (str): Attribute string sent with the packet.
+    didErrCorrect (bool): ``True`` if the packet was decoded.
+    resultStr (str): Result string.
+    isShort (bool): ``True`` if ADS-B short message.
+    strategy (str): 'deep' or 'hub' for the station report.
+  """
+  pktType = 'fisb' if parseAttributes(attrStr)[4] else 'adsb'
+
+  if didErrCorrect:
+    stats[pktType + '_decoded'] += 1
+    emitResult(resultStr, attrStr, isShort, True)
+  else:
+    stats[pktType + '_failed'] += 1
+
+  if station_report is not None:
+    stationCount(attrStr, didErrCorrect, resultStr, [strategy])
+
+def sendFrame(sock, frameType, payload):
+  """
+  Send a hub protocol frame.
+
+  Args:
+    sock (socket): Connected socket.
+    frameType (bytes): b'J', b'R' or b'C'.
+    payload (bytes): Frame payload.
+
+  Raises:
+    OSError: If the send fails.
+  """
+  sock.sendall(HUB_FRAME.pack(frameType, len(payload)) + payload)
+
+def recvFrame(rfile):
+  """
+  Read a hub protocol frame.
+
+  Args:
+    rfile (file): Socket file opened for reading in binary.
+
+  Returns:
+    tuple: Frame type and payload, or ``None`` if the connection closed.
+
+  Raises:
+    ValueError: If the payload is larger than ``HUB_FRAME_MAX``.
+  """
+  header = rfile.read(HUB_FRAME.size)
+  if len(header) < HUB_FRAME.size:
+    return None
+
+  frameType, length = HUB_FRAME.unpack(header)
+  if length > HUB_FRAME_MAX:
+    raise ValueError('Frame too large')
+
+  payload = rfile.read(length)
+  if len(payload) < length:
+    return None
+
+  return frameType, payload
+
+def hubSettings():
+  """
+  Get the settings sent to the hub with each packet.
+
+  Returns:
+    dict: ``HUB_SETTINGS`` values, and 'f6b' with the ``--f6b`` values
+    (if used) as a list of hex strings.
+  """
+  settings = {x: globals()[x] for x in HUB_SETTINGS}
+  settings['f6b'] = []
+  if replace_f6b:
+    settings['f6b'] = [x.tobytes().hex() for x in f6bArray[0:f6bArrayLen]]
+  return settings
+
+def hubSubmit(packetBuf, attrStr):
+  """
+  Send a packet that failed the fast pass to the hub (``--hub``),
+  connecting first if needed (at most every ``HUB_RETRY_SECS``).
+
+  Args:
+    packetBuf (bytes): Packet as read.
+    attrStr (str): Attribute string sent with the packet.
+
+  Returns:
+    bool: ``True`` if sent. ``False`` if there is no connection or no
+    credit, and the packet should be decoded locally.
+  """
+  global hubSock, hubCredits, hubNextTry, hubNextTag
+
+  with hubLock:
+    if hubSock is None:
+      if time.time() < hubNextTry:
+        return False
+
+      hubNextTry = time.time() + HUB_RETRY_SECS
+
+      try:
+        hubSock = socket.create_connection(hub_address, timeout=5)
+        hubSock.settimeout(None)
+      except OSError:
+        hubSock = None
+        return False
+
+      hubCredits = 0
+      threading.Thread(target=hubReaderThread, args=(hubSock,), \
+          daemon=True).start()
+
+    if hubCredits <= 0:
+      return False
+
+    tag = hubNextTag
+    hubNextTag = (hubNextTag + 1) & 0xffffffff
+
+    settingsJson = json.dumps(hubSettings()).encode()
+
+    try:
+      sendFrame(hubSock, b'J', struct.pack('<I', tag) + attrStr.encode() + \
+          struct.pack('<H', len(settingsJson)) + settingsJson + packetBuf)
+    except OSError:
+      # The reader thread will see the connection drop too.
+      hubSock.close()
+      return False
+
+    hubCredits -= 1
+    hubOutstanding[tag] = (packetBuf, attrStr)
+
+  return True
+
+def hubReaderThread(sock):
+  """
+  Read credits and results from the hub. When the connection drops, the
+  packets the hub still had are given to the local deep decode worker.
+
+  Args:
+    sock (socket): Socket connected to the hub.
+  """
+  global hubSock, hubCredits, hubNextTry
+
+  rfile = sock.makefile('rb')
+
+  try:
+    while True:
+      frame = recvFrame(rfile)
+      if frame is None:
+        break
+
+      frameType, payload = frame
+
+      if frameType == b'C':
+        with hubLock:
+          hubCredits += struct.unpack('<I', payload[0:4])[0]
+
+      elif frameType == b'R':
+        tag, didErrCorrect, isShort = struct.unpack_from('<IBB', payload)
+        resultStr = payload[6:].decode()
+
+        with hubLock:
+          job = hubOutstanding.pop(tag, None)
+
+        if job is None:
+          continue
+
+        if didErrCorrect:
+          stats['hub_decoded'] += 1
+
+        lateResult(job[1], didErrCorrect == 1, resultStr or None, \
+            isShort == 1, 'hub')
+  except (OSError, ValueError, struct.error):
+    pass
+
+  with hubLock:
+    if hubSock is sock:
+      hubSock = None
+      hubCredits = 0
+      hubNextTry = time.time() + HUB_RETRY_SECS
+
+    # Requeue before clearing. main() sends the deep decode worker its
+    # last job once hubOutstanding is empty, so nothing can come after.
+    for packetBuf, attrStr in hubOutstanding.values():
+      deepFallback(packetBuf, attrStr)
+
+    hubOutstanding.clear()
+
+  sock.close()
+
+def deepFallback(packetBuf, attrStr):
+  """
+  Give a packet the hub didn't finish to the local deep decode worker,
+  or count it as failed if the worker is too far behind.
+
+  Args:
+    packetBuf (bytes): Packet as read.
+    attrStr (str): Attribute string sent with the packet.
+  """
+  stats['hub_fallback'] += 1
+
+  try:
+    deepJobQueue.put_nowait((packetBuf, attrStr, \
+        deepSettings(parseAttributes(attrStr)[0]), None))
+    stats['deep_queued'] += 1
+  except queue.Full:
+    stats['deep_dropped'] += 1
+    lateResult(attrStr, False, None, False, 'hub')
+
+def hubSend(connId, frameType, payload):
+  """
+  Send a frame to a hub connection (hub side). Nothing is sent if the
+  connection has closed.
+
+  Args:
+    connId (int): Connection id.
+    frameType (bytes): b'R' or b'C'.
+    payload (bytes): Frame payload.
+  """
+  with hubLock:
+    conn = hubConnections.get(connId)
+
+  if conn is None:
+    return
+
+  with conn[1]:
+    try:
+      sendFrame(conn[0], frameType, payload)
+    except OSError:
+      pass
+
+def hubApplySettings(settings):
+  """
+  Check the settings sent with a job and turn them into globals for
+  ``deepDecodeWorker()`` (hub side).
+
+  Args:
+    settings (dict): Settings from ``hubSettings()``.
+
+  Returns:
+    dict: Global name and value.
+
+  Raises:
+    ValueError: If a setting is not valid.
+  """
+  newSettings = {}
+
+  for name in HUB_SETTINGS:
+    if not isinstance(settings.get(name), bool):
+      raise ValueError(f'Bad setting {name}')
+    newSettings[name] = settings[name]
+
+  newSettings['f6bArray'] = parseF6b(' '.join(settings.get('f6b', [])))
+  newSettings['f6bArrayLen'] = len(newSettings['f6bArray'])
+  if newSettings['f6bArrayLen'] == 0:
+    newSettings['replace_f6b'] = False
+
+  return newSettings
+
+class HubHandler(socketserver.StreamRequestHandler):
+  """
+  Handle a connection to the hub. Gives the connection its credits, then
+  queues each job received for the workers. Results are sent back by
+  ``hubDispatchThread()``.
+  """
+  def handle(self):
+    global hubNextConn
+
+    with hubLock:
+      connId = hubNextConn
+      hubNextConn += 1
+      hubConnections[connId] = (self.request, threading.Lock())
+
+    print(f'hub connection {connId} from {self.client_address}', \
+        file=sys.stderr)
+
+    try:
+      hubSend(connId, b'C', struct.pack('<I', HUB_CREDITS_PER_JOB * hub_jobs))
+
+      while True:
+        frame = recvFrame(self.rfile)
+        if frame is None:
+          break
+
+        frameType, payload = frame
+        if frameType != b'J':
+          continue
+
+        tag = struct.unpack_from('<I', payload)[0]
+        attrStr = payload[4:4 + ATTRIBUTE_LEN].decode()
+        settingsLen = struct.unpack_from('<H', payload, 4 + ATTRIBUTE_LEN)[0]
+        settingsStart = 4 + ATTRIBUTE_LEN + 2
+        settings = hubApplySettings(json.loads( \
+            payload[settingsStart:settingsStart + settingsLen]))
+        packetBuf = payload[settingsStart + settingsLen:]
+
+        packetLength = PACKET_LENGTH_FISB if parseAttributes(attrStr)[4] \
+            else PACKET_LENGTH_ADSB
+        if len(packetBuf) != packetLength:
+          raise ValueError('Bad packet length')
+
+        hubJobQueue.put((packetBuf, attrStr, settings, (connId, tag)))
+    except (OSError, ValueError, IndexError, struct.error) as e:
+      print(f'hub connection {connId}: {e}', file=sys.stderr)
+
+    with hubLock:
+      del hubConnections[connId]
+
+    print(f'hub connection {connId} closed', file=sys.stderr)
+
+def hubDispatchThread(resultQueue):
+  """
+  Send worker results back to the connection the job came from, with a
+  credit, and write decoded packets to our own standard output (hub
+  side).
+
+  Args:
+    resultQueue (multiprocessing.Queue): Results from
+      ``deepDecodeWorker()``.
+  """
+  while True:
+    result = resultQueue.get()
+    if result is None:
+      continue
+
+    attrStr, didErrCorrect, resultStr, isShort, (connId, tag) = result
+
+    hubSend(connId, b'R', struct.pack('<IBB', tag, didErrCorrect, \
+        isShort) + (resultStr or '').encode())
+    hubSend(connId, b'C', struct.pack('<I', 1))
+
+    stats['fisb_packets' if parseAttributes(attrStr)[4] else \
+        'adsb_packets'] += 1
+
+    if didErrCorrect:
+      stats['hub_decoded'] += 1
+      emitResult(resultStr, attrStr, isShort)
+
+def mainHubServe(port):
+  """
+  Run as a hub (``--hubserve``): decode packets sent by other
+  ``ec_978.py`` instances with ``--hub`` using ``hub_jobs`` worker
+  processes. Results go back to the sender, and decoded packets are also
+  written to standard output. Runs until interrupted.
+
+  Args:
+    port (int): TCP port to listen on.
+  """
+  global hubJobQueue
+
+  hubJobQueue = multiprocessing.Queue()
+  resultQueue = multiprocessing.Queue()
+
+  for _ in range(hub_jobs):
+    multiprocessing.Process(target=deepDecodeWorker, \
+        args=(hubJobQueue, resultQueue), daemon=True).start()
+
+  threading.Thread(target=hubDispatchThread, args=(resultQueue,), \
+      daemon=True).start()
+
+  socketserver.ThreadingTCPServer.allow_reuse_address = True
+  server = socketserver.ThreadingTCPServer(('0.0.0.0', port), HubHandler)
+  server.daemon_threads = True
+
+  print(f'hub on port {port} with {hub_jobs} workers', file=sys.stderr)
+
+  try:
+    server.serve_forever()
+  except KeyboardInterrupt:
+    sys.exit(0)
+
+def heartbeat(attrStr, payload):
+  """
+  Handle a heartbeat frame from demod_978 (``-b``).
+
+  demod_978 numbers the packets it writes from 0, and each heartbeat has
+  the number of the next one. If fewer packets arrived since the last
+  heartbeat than the numbers say, packets were lost between us and
+  demod_978 ('seq_lost'). The time the heartbeat was sent gives how far
+  behind we are ('hb_latency_ms'). With ``--hb`` the heartbeat is passed
+  on as a line like::
+
+    #HB t=1638556942.209;seq=224;samples=3560832;fisb=117;adsb=107;dropped=0;lost=0;interval=1000
+
+  Args:
+    attrStr (str): Attribute string of the heartbeat.
+    payload (bytes): ``HEARTBEAT_LENGTH`` bytes following it.
+  """
+  global lastHeartbeat, packetsSinceHeartbeat
+
+  if len(payload) != HEARTBEAT_LENGTH:
+    return
+
+  values = HEARTBEAT.unpack(payload)
+  splitName = attrStr.split('.')
+  sentTime = float(splitName[0] + '.' + splitName[1])
+
+  stats['heartbeats'] += 1
+
+  # A lower number means demod_978 was restarted.
+  if (lastHeartbeat is not None) and (values[0] >= lastHeartbeat[0]):
+    lost = values[0] - lastHeartbeat[0] - packetsSinceHeartbeat
+    if lost > 0:
+      stats['seq_lost'] += lost
+      print(f'{lost} packets lost from demod_978', file=sys.stderr)
+
+  stats['demod_dropped'] = values[4] + values[5]
+  stats['hb_latency_ms'] = int((time.time() - sentTime) * 1000)
+
+  lastHeartbeat = values
+  packetsSinceHeartbeat = 0
+
+  if heartbeat_lines:
+    with outputLock:
+      print(f'#HB t={splitName[0]}.{splitName[1][0:3]};seq={values[0]};' + \
+          f'samples={values[1]};fisb={values[2]};adsb={values[3]};' + \
+          f'dropped={values[4] + values[5]};lost={stats["seq_lost"]};' + \
+          f'interval={values[7]}', flush=True)
+
+def main():
+  """
+  Process raw FIS-B and ADS-B (short and long) demodulated samples from
+  standard input (usually from ``demod_978``).
+
+  We read a fixed length attribute string containing information
+  about the packet to follow. Then we read the packet and process it.
+
+  Rinse and repeat.
+
+  Output is sent to standard output. If indicated (``-se``), errors 
+  can be saved seperately in files.
+
+  With ``--deep``, packets get a fast first pass here. The ones that
+  fail are sent to ``deepDecodeWorker()`` and any it decodes are
+  written later by ``deepResultThread()``.
+  """
+  global fast_pass, deepJobQueue, packetsSinceHeartbeat
+
+  jobQueue = None
+  if deep_decode:
+    jobQueue = multiprocessing.Queue(DEEP_QUEUE_MAX)
+    deepJobQueue = jobQueue
+    resultQueue = multiprocessing.Queue()
+
+    worker = multiprocessing.Process(target=deepDecodeWorker, \
+        args=(jobQueue, resultQueue), daemon=True)
+    worker.start()
+
+    resultThread = threading.Thread(target=deepResultThread, \
+        args=(resultQueue,), daemon=True)
+    resultThread.start()
+
+    fast_pass = True
+
+  # Time to next save the learned 1st 6 byte values.
+  f6bSaveTime = time.time() + F6B_SAVE_SECS
+
+  # Time of the last packet read (for the final station report).
+  timeStr = None
+
+  try:
+    while True:
+      # We alternate reading attributes and packets
+
+      # Read attributes
+      attributes = sys.stdin.buffer.read(ATTRIBUTE_LEN)
+
+      # Convert from bytes to string for parsing.
+      attrStr = "".join(chr(x) for x in attributes)
+
+      # Exit if nothing more to read (should only happen when
+      # reading from file).
+      if attrStr == '':
+        break
+
+      # Heartbeats from demod_978 (-b) are not packets.
+      if attrStr.split('.')[2] == 'H':
+        heartbeat(attrStr, sys.stdin.buffer.read(HEARTBEAT_LENGTH))
+        continue
+
+      timeStr, _, _, _, isFisbPacket = parseAttributes(attrStr)
+
+      isShortPacket = (attrStr.split('.')[2] == 'S')
+
+      if isFisbPacket:
+        packetLength = PACKET_LENGTH_FISB
+        pktType = 'fisb'
+      elif isShortPacket:
+        packetLength = PACKET_LENGTH_ADSB_SHORT
+        pktType = 'adsb'
+      else:
+        packetLength = PACKET_LENGTH_ADSB
+        pktType = 'adsb'
+
+      # Read packet as a set of bytes
+      packetBuf = sys.stdin.buffer.read(packetLength)
+      packetsSinceHeartbeat += 1
+
+      # Pad short packets to the usual length.
+      if isShortPacket:
+        packetBuf += bytes(PACKET_LENGTH_ADSB - len(packetBuf))
+        stats['adsb_short'] += 1
+
+      # Save to file if we are saving data for further study.
+      if save_raw_data_to_disk:
+        with open(timeStr + '.' + pktType[0].upper() + '.i32', 'wb') \
+            as bfile:
+          bfile.write(packetBuf)
+
+      # Numpy will convert the bytes to int32's
+      packet = np.frombuffer(packetBuf, np.int32)
+
+      # Decide how much time we can spend on this packet.
+      setDecodeBudget(timeStr)
+
+      if (f6b_auto_file is not None) and (time.time() >= f6bSaveTime):
+        f6bSave(f6b_auto_file)
+        f6bSaveTime = time.time() + F6B_SAVE_SECS
+
+      didErrCorrect, resultStr, isShort = decodePacket(packet, attrStr)
+
+      stats[pktType + '_packets'] += 1
+
+      if budget_was_cut:
+        stats['budget_cut'] += 1
+
+      if station_report is not None:
+        stationReportCheck(timeStr)
+
+      if didErrCorrect:
+        stats[pktType + '_decoded'] += 1
+        emitResult(resultStr, attrStr, isShort)
+
+        if station_report is not None:
+          stationCount(attrStr, True, resultStr, packetStrategies)
+        continue
+
+      # Send the packet to the hub if we can.
+      if (hub_address is not None) and hubSubmit(packetBuf, attrStr):
+        stats['hub_sent'] += 1
+        continue
+
+      # Hand the packet to the deep decode worker. If it is too far
+      # behind, the packet is counted as failed.
+      if jobQueue is not None:
+        try:
+          jobQueue.put_nowait((packetBuf, attrStr, deepSettings(timeStr), \
+              None))
+          stats['deep_queued'] += 1
+          continue
+        except queue.Full:
+          stats['deep_dropped'] += 1
+
+      stats[pktType + '_failed'] += 1
+      writeErrorFile(packetBuf, attrStr, resultStr, isFisbPacket)
+
+      if station_report is not None:
+        stationCount(attrStr, False, resultStr, packetStrategies)
+
+    # Wait for the hub's last results. Any it doesn't send go to the
+    # deep decode worker.
+    if hub_address is not None:
+      drainEnd = time.time() + HUB_DRAIN_SECS
+      while (len(hubOutstanding) > 0) and (time.time() < drainEnd):
+        time.sleep(0.1)
+
+      with hubLock:
+        if hubSock is not None:
+          hubSock.shutdown(socket.SHUT_RDWR)
+
+      while len(hubOutstanding) > 0:
+        time.sleep(0.1)
+
+    # Let the deep decode worker finish what it has.
+    if jobQueue is not None:
+      jobQueue.put(None)
+      resultThread.join()
+      worker.join()
+
+    if (station_report is not None) and (timeStr is not None):
+      stationReportCheck(timeStr, True)
+
+  except KeyboardInterrupt:
+    sys.exit(0)
+
+  finally:
+    if f6b_auto_file is not None:
+      f6bSave(f6b_auto_file)
+
+def mainReprocessErrors(errorDir):
+  """
+  Reprocess any errors from the specified error directory
+  (called when ``-re`` argument is given).
+
+  This option will reprocess any errors that are in the
+  error directory. This is used to study particular messages
+  and create improved techniques for decoding.
+
+  It does not delete any files in the directory and only
+  one pass is made through the directory.
+
+  If any message cannot be error corrected, it is not written to
+  any error directory (even if specified).
+
+  It will always print FIS-B and ADS-B errors.
+
+  Args:
+    errorDir (str): Directory where the error files are.
+  """
+  errFiles = glob.glob(os.path.join(errorDir, '*.i32'))
+
+  for filen in errFiles:
+    # find last index of '/'
+    lastSlash = filen.rfind('/')
+
+    attrStr = filen[lastSlash + 1:]
+
+    splitName = attrStr.split(".")
+
+    # Create time string and signal strength string from the
+    # file components.
+    timeStr = splitName[0] + '.' + splitName[1][0:3]
+    signalStrengthString = str(round(int(splitName[3]) \
+        / 1000000.0, 2))
+      
+    # Extract sync errors
+    syncErrors = splitName[4]
+
+    # Detect if this an a FIS-B packet ('F') or ADS-B packet ('A').
+    if (splitName[2] == 'F'):
+      isFisbPacket = True
+      packetLength = PACKET_LENGTH_FISB
+    else:
+      isFisbPacket = False
+      packetLength = PACKET_LENGTH_ADSB
+
+    with open(filen, 'rb') as filePtr:
+       # Read packet as a set of bytes
+      packetBuf = filePtr.read(packetLength)
+
+    # Numpy will convert the bytes to int32's
+    packet = np.frombuffer(packetBuf, np.int32)
+
+    if isFisbPacket:
+      didErrCorrect, resultStr = fisbProcessPacket(packet, timeStr, \
+        signalStrengthString, syncErrors, attrStr)
+    else:
+      didErrCorrect, resultStr, _ = adsbProcessPacket(packet, timeStr, \
+        signalStrengthString, syncErrors, attrStr)
+
+    if didErrCorrect:
+      # Write to standard output.
+      print(resultStr, flush=True)
+
+# Call main function
+if __name__ == "__main__":
 
   hlpText = \
     """ec_978.py: Error correct FIS-B and ADS-B demodulated data from 'demod_978'.
@@ -1647,6 +4093,20 @@ quotes and separated by spaces. Examples of use would be:
     --f6b 3514c952d65c
     --f6b '3514c952d65c 38f18185534c'
 
+f6bauto
+=======
+Learns the first six bytes from packets that decode, so you don't have to
+find them for '--f6b'. Values are counted for each data channel (which
+stays the same for a ground station), and up to 3 are kept for each.
+When block zero of a packet fails, the 2 most decoded values for the
+data channel the packet's arrival time says it was sent on are tried
+(then the most decoded values overall). With a file playback the arrival
+times can't be used, so only the values decoded most overall are tried.
+The argument is a file the learned values are kept in between runs. It is
+saved every 5 minutes and at exit. Any '--f6b' values are tried first.
+
+    --f6bauto f6b.learned
+
 ll
 ==
 demod_978 uses a cutoff signal level to avoid trying to decode noise packets
@@ -1746,6 +4206,179 @@ is save in its own file. The files are saved in the current directory
 and have a name of the form: '1646349680.227.F.i32' where
 '1646349680.227' is the UTC epoch time of arrival, 'F' means FIS-B
 ('A' means ADS-B, either short or long). The extension is always '.i32'.
+
+budget
+======
+Limits the time spent trying to decode any one packet to the given number
+of milliseconds. Normally every strategy is tried on every packet that
+fails, which can make us fall behind on slow hardware during bursts of
+FIS-B. As we fall behind (judged by the lag between the packet arrival
+time and now, and how full our input pipe is) the budget shrinks, down to
+5% of its value at 5 seconds of lag. The first shift is always tried.
+With a budget, the extra strategies (block zero tricks, trailing zeros,
+offset 2, and the extra ADS-B attempts) are tried in order of measured
+decodes per microsecond. The number of packets whose budget ran out is
+shown by the control socket 'stats' command as 'budget_cut'. A value of
+something like 50 is a good place to start.
+
+shifts
+======
+Loads shift tables made by 'shift_train.py' from a file. Normally shifts
+are tried in a fixed order found from a large number of packets. The
+tables replace this order with one found from your own packets, for each
+packet type and signal level. A table may leave out shifts that rarely
+work, which saves time on packets that won't decode. With '--adapt', the
+learned order starts from the table order.
+
+adapt
+=====
+Learns the order to try shifts in while running. The number of times each
+shift works is kept for each packet type (FIS-B or ADS-B) and signal
+level, and shifts are tried most successful first. The shift that worked
+for the last packet from the same ground station is tried before any of
+them. The station is told from the packet's arrival time, so with a file
+playback the last packet of the same type and signal level is used
+instead. The control socket 'stats' command shows the number of
+Reed-Solomon attempts as 'rs_attempts'.
+
+fixed
+=====
+Shifts bits using only integer math, for computers without a floating
+point unit. Shifts are whole percentages, and only the sign of each
+shifted bit is used, so decodes are the same. Use with
+'demod_978_fixed' (see 'make demod_978_fixed').
+
+priors
+======
+Learns which FIS-B data bits (in any block) almost always have the same
+value for a ground station, such as frame headers and fill. When a block
+fails to decode, it is tried again with those bits forced, like block zero
+fixed bits ('--nobzfb') but learned. A bit is forced once the station has
+30 decoded packets and the bit had the same value in 99% of them. The
+station is told from the packet's arrival time. With a file playback, all
+stations are counted together.
+
+cache
+=====
+FIS-B ground stations send the same products over and over, so the same
+blocks arrive many times. Decoded blocks are kept (up to 5000). A block
+that fails is compared with the ones kept, and if it differs from one in
+no more than 16 of its 92 bytes, that block is used. This is more errors
+than Reed-Solomon can fix (10), but is safe since we know what to expect.
+The error count shown for the block is the number of bytes that
+differed. The control socket 'stats' command shows 'cache_hits'.
+
+dedup, dupflag
+==============
+Ground stations send the same products many times, and nearby stations
+send the same products. '--dedup SECS' looks at the UAT frames in each
+FIS-B packet and drops the packet if every frame in it was already sent
+in the last SECS seconds (frames are compared by type, product id and a
+hash of the frame). A frame is sent again once SECS have passed since it
+was last sent. Packets with no frames are always sent. With '--dupflag',
+no packets are dropped. Instead ';dup=n/m' is added to packets where n of
+their m frames are duplicates (not for '--d978' or '--d978fa'). The
+control socket 'stats' command shows 'dedup_frames', 'dedup_dups' and
+'dedup_dropped'.
+
+report
+======
+Writes a reception report for each FIS-B ground station to standard
+error every REPORT seconds (and at the end). Each data channel is sent
+once a second, so a station should have a packet every second on each of
+its channels from when we first hear it. For each data channel the report
+shows the site ('15H' is TIS-B site 15, high power), the station (first 6
+bytes of block 0), packets expected, decoded, failed, and missed (never
+seen), percent decoded, mean signal level, and how many packets each
+decode strategy helped with ('normal' if none were needed, 'deep' for
+'--deep' results). Failed packets are put on a channel only when the
+arrival time tells us the slot (not for file playback), otherwise they
+are shown on channel 0. The control socket 'stations' command shows the
+report so far. This is the best way to compare sites and antennas.
+
+adsbrate
+========
+An aircraft can send ADS-B messages every second, even when nothing has
+changed. With '--adsbrate SECS', a table of aircraft is kept and a
+message is only sent for an aircraft if it is new, its air/ground state
+or call sign changed, its altitude changed by 100 feet or more, or SECS
+seconds have passed since the last message sent for it. Aircraft not
+heard for 5 minutes are dropped. The control socket 'aircraft' command
+lists the table and 'stats' shows 'adsb_limited'.
+
+addr
+====
+When an ADS-B packet fails, tries it again with the address forced to that
+of an aircraft heard in the last minute at a similar signal level (within
+a factor of 2). Up to 3 aircraft are tried, most recently heard first.
+The decoded address must be the one forced. This gets extra decodes of
+weak aircraft we are already tracking.
+
+deep
+====
+Splits decoding in two. Each packet first gets a fast pass using only the
+5 most likely shifts (and, for ADS-B, the other message length). Packets
+that fail are handed to a worker process running at a lower priority
+which tries everything. Packets it decodes are written when it is done,
+usually out of order, with their original 't=' time and ';late' added
+to the end (not for '--d978' or '--d978fa'). Failure comments and error
+files ('--ff', '--fa', '--se') come from the worker. If the worker is
+more than 200 packets behind, packets that fail the fast pass are
+counted as failed without a second try. The control socket 'stats'
+command shows 'deep_queued', 'deep_decoded' and 'deep_dropped'.
+Ignored with '--re'.
+
+hub
+===
+Like '--deep' (which it turns on), but packets that fail the fast pass
+are sent over TCP to a hub (another 'ec_978.py' run with '--hubserve')
+at HOST:PORT. The hub's results come back here and are written like
+'--deep' results. The hub gives each connection credits, and a packet is
+only sent when we have one, so a busy hub can't fall behind. Packets the
+hub can't take, or that it still has if the connection drops, go to the
+local worker. If the hub can't be reached, we try again every 10 seconds.
+At the end we wait up to 30 seconds for the hub's last results. The
+'--f6b', '--apd', '--fet', '--nobzfb' and '--noftz' settings are sent
+with each packet. Learned values ('--priors', '--cache', '--addr',
+'--f6bauto') are not, and failure comments for packets the hub fails are
+not written. The 'stats' command shows 'hub_sent', 'hub_decoded' and
+'hub_fallback'.
+
+hubserve, hubjobs
+=================
+Runs as a hub on the given TCP port instead of reading standard input.
+Packets from any number of '--hub' senders are decoded by '--hubjobs'
+worker processes (default number of CPUs) and the results sent back.
+Decoded packets are also written to standard output. Several
+'ec_978.py --hubserve' processes on one machine can stand in for remote
+machines when testing.
+
+hb
+==
+Pass heartbeat frames from demod_978 ('-b') on as '#HB' lines so
+server_978.py can tell a quiet channel from a stopped demod_978. Without
+'--hb', heartbeats are still used: the 'stats' command shows
+'heartbeats', packets lost between demod_978 and us ('seq_lost'),
+packets dropped by demod_978's output queue ('demod_dropped') and how
+far behind demod_978 we are ('hb_latency_ms'). Other programs reading
+our output may not expect '#HB' lines.
+
+ctl
+===
+Opens a control socket on 127.0.0.1 at the given port. Settings can be
+changed while running without losing any packets. Connect with something
+like 'nc 127.0.0.1 <port>' and type one command per line:
+
+    get                   Show current settings.
+    stats                 Show packet counts.
+    stations              Show the '--report' station report so far.
+    aircraft              Show the '--adsbrate' aircraft table.
+    set <name> on|off     Change a setting. <name> is one of: ff, fa,
+                          ll, bzfb, ftz, apd, fet, saveraw.
+    set f6b <hex> ...     Replace the '--f6b' values ('off' to stop).
+
+Each reply ends with 'ok' or 'error <reason>'. demod_978 has a similar
+control socket ('-c').
 """
   parser = argparse.ArgumentParser(description= hlpText, \
           formatter_class=RawTextHelpFormatter)
@@ -1767,6 +4400,8 @@ and have a name of the form: '1646349680.227.F.i32' where
     help='Show FIS-B extra timing information.', action='store_true')
   parser.add_argument("--f6b", required=False, \
     help='Hex strings of first 6 bytes of block zero.')
+  parser.add_argument("--f6bauto", required=False, \
+    help='Learn first 6 bytes of block zero. Keep them in this file.')
   parser.add_argument("--se", required=False, \
     help='Directory to save failed error corrections.')
   parser.add_argument("--re", required=False, \
@@ -1777,6 +4412,44 @@ and have a name of the form: '1646349680.227.F.i32' where
     help='Mimic dump978-fa output format.', action='store_true')
   parser.add_argument("--saveraw", \
     help='Save demod_978 output in file.', action='store_true')
+  parser.add_argument("--ctl", type=int, required=False, \
+    help='Port for control socket on 127.0.0.1.')
+  parser.add_argument("--budget", type=float, required=False, \
+    help='Decode time budget per packet in milliseconds.')
+  parser.add_argument("--shifts", required=False, \
+    help='Load shift tables made by shift_train.py.')
+  parser.add_argument("--adapt", \
+    help='Learn shift order while running.', action='store_true')
+  parser.add_argument("--fixed", \
+    help='Shift bits with integer math.', action='store_true')
+  parser.add_argument("--priors", \
+    help='Learn and force constant FIS-B bits.', action='store_true')
+  parser.add_argument("--cache", \
+    help='Match failed FIS-B blocks with recently decoded ones.', \
+    action='store_true')
+  parser.add_argument("--addr", \
+    help='Force recently heard ADS-B addresses on failed packets.', \
+    action='store_true')
+  parser.add_argument("--dedup", type=float, required=False, \
+    help='Drop FIS-B packets with only frames sent in the last DEDUP secs.')
+  parser.add_argument("--dupflag", \
+    help='With --dedup, flag duplicates instead of dropping.', \
+    action='store_true')
+  parser.add_argument("--report", type=float, required=False, \
+    help='Write a station reception report every REPORT seconds.')
+  parser.add_argument("--adsbrate", type=float, required=False, \
+    help='Send ADS-B state changes, else one per aircraft each ADSBRATE secs.')
+  parser.add_argument("--deep", \
+    help='Fast pass inline, failures decoded by a background worker.', \
+    action='store_true')
+  parser.add_argument("--hub", required=False, \
+    help='Send fast pass failures to a hub at HOST:PORT.')
+  parser.add_argument("--hubserve", type=int, required=False, \
+    help='Run as a hub on TCP port HUBSERVE.')
+  parser.add_argument("--hubjobs", type=int, required=False, \
+    help='Worker processes for --hubserve (default number of CPUs).')
+  parser.add_argument("--hb", \
+    help='Write demod_978 heartbeats as #HB lines.', action='store_true')
 
   args = parser.parse_args()
 
@@ -1824,27 +4497,83 @@ and have a name of the form: '1646349680.227.F.i32' where
   if args.f6b:
     replace_f6b = True
 
-    hexStrList = args.f6b.split()
-    
-    f6bArrayLen = len(hexStrList)
-    f6bArray = np.zeros((f6bArrayLen, 6), dtype=np.uint8)
+    try:
+      f6bArray = parseF6b(args.f6b)
+    except ValueError as e:
+      print(e, file=sys.stderr)
+      sys.exit(1)
 
-    for i, hexstr in enumerate(hexStrList):
-      # Catch non-hex values
-      try:
-        int(hexstr, 16)
-      except ValueError:
-        print('Illegal hex for --f6b', file=sys.stderr)
-        sys.exit(1)
+    f6bArrayLen = len(f6bArray)
+
+  if args.f6bauto:
+    f6b_auto_file = args.f6bauto
+    f6bLoad(f6b_auto_file)
+
+  if args.ctl:
+    control_port = args.ctl
+
+  if args.budget:
+    decode_budget = args.budget / 1000.0
+
+    # F_GETPIPE_SZ is Linux only.
+    try:
+      stdinPipeSize = fcntl.fcntl(sys.stdin.fileno(), fcntl.F_GETPIPE_SZ)
+    except (OSError, AttributeError):
+      pass
+
+  if args.adapt:
+    adapt_shifts = True
 
-      # Length has to be 12
-      if (len(hexstr) != 12):
-        print('Hex string length must be 12', file=sys.stderr)
-        sys.exit(1)
+  if args.fixed:
+    fixed_point = True
 
-      # Convert hex to array.
-      for j in range(0, 6):
-        f6bArray[i][j] = int(hexstr[j*2:(j*2)+2], 16)
+  if args.shifts:
+    try:
+      loadShiftTables(args.shifts)
+    except (OSError, ValueError) as e:
+      print(e, file=sys.stderr)
+      sys.exit(1)
+
+  if args.priors:
+    learn_priors = True
+
+  if args.cache:
+    block_cache = True
+
+  if args.dedup is not None:
+    dedup_window = args.dedup
+
+  if args.dupflag:
+    dedup_flag = True
+
+  if args.adsbrate is not None:
+    adsb_rate = args.adsbrate
+
+  if args.report is not None:
+    station_report = args.report
+
+  if args.addr:
+    adsb_address_priors = True
+
+  if args.deep:
+    deep_decode = True
+
+  if args.hub is not None:
+    host, _, port = args.hub.rpartition(':')
+    try:
+      hub_address = (host, int(port))
+    except ValueError:
+      print('--hub must be HOST:PORT.', file=sys.stderr)
+      sys.exit(1)
+
+    # The local worker decodes what the hub doesn't.
+    deep_decode = True
+
+  if args.hubjobs is not None:
+    hub_jobs = args.hubjobs
+
+  if args.hb:
+    heartbeat_lines = True
 
   # If reprocessing errors call mainReprocessErrors() else main()
   if args.re:
@@ -1857,4 +4586,10 @@ and have a name of the form: '1646349680.227.F.i32' where
     
     mainReprocessErrors(args.re)
   else:
-    main()
+    if control_port is not None:
+      startControlServer(control_port)
+
+    if args.hubserve is not None:
+      mainHubServe(args.hubserve)
+    else:
+      main()
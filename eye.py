@@ -269,6 +269,31 @@ def eyeDiagram(packet):
 
   plt.show()
 
+def eyeDensity(fname):
+  """
+  Show an eye diagram density histogram made by eye_density.py.
+
+  Counts are shown on a log scale so rare paths through the eye still
+  show up.
+
+  Args:
+    fname (str): '.npz' file from eye_density.py.
+  """
+  density = np.load(fname)
+  hist = density['hist']
+  points = int(density['points'])
+  yLimit = float(density['yLimit'])
+
+  fig, ax = plt.subplots(figsize=(6, 7.5))
+  ax.imshow(np.log1p(hist.T), origin='lower', aspect='auto', \
+      cmap='inferno', extent=[0, points, -yLimit, yLimit])
+  plt.axhline(y=0, c='white', linestyle='--', linewidth=0.5)
+  plt.xlabel('Data points (2 samples / data point)')
+  plt.ylabel('Values (scaled by mean bit center)')
+  plt.title(f'Eye density of {int(density["packets"])} packets')
+
+  plt.show()
+
 def main(fname):
   """
   Read 'fname' from disk and display requested images.
@@ -276,6 +301,10 @@ def main(fname):
   Args:
     fname (str): Filename containing data to process.
   """
+  if showDensity:
+    eyeDensity(fname)
+    return
+
   # See if file is FIS-B or ADS-B
   if '.F.' in fname:
     isFisb = True
@@ -353,6 +382,10 @@ eye better in noisy signals.
 
 If you are displaying more than one diagram, the next diagram will 
 appear after closing the window of the current diagram.
+
+'--density' shows an eye diagram of many packets made by
+'eye_density.py'. 'fname' is the '.npz' file it saved. Brighter areas
+are where the signal passed more often (on a log scale).
 """
   parser = argparse.ArgumentParser(description= hlpText, \
           formatter_class=RawTextHelpFormatter)
@@ -373,6 +406,8 @@ appear after closing the window of the current diagram.
     help='Show first and last 10 pct no smoothing.', action='store_true')
   parser.add_argument("--fls", \
     help='Show first and last 10 pct with smoothing.', action='store_true')
+  parser.add_argument("--density", \
+    help='Show density diagram from eye_density.py.', action='store_true')
 
 
   args = parser.parse_args()
@@ -384,6 +419,7 @@ appear after closing the window of the current diagram.
   showFlns = False
   showFls = False
   showAll = False
+  showDensity = False
 
   if args.all:
     showAll = True
@@ -406,6 +442,9 @@ appear after closing the window of the current diagram.
   if args.fls:
     showFls = True
 
+  if args.density:
+    showDensity = True
+
   # Assume --all if no options set, or --all set
   if ((not showAdpns) and (not showAdps) and (not showFlns) and (not showFls) \
       and (not showAll) and (not showAdpgfb) and (not showAdpgbf)) or showAll:
@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+
+"""
+eye_density.py - Build eye diagram density histograms
+======================================================
+
+Reads any number of demodulated packets saved by ec_978.py (``--saveraw``
+or ``--se``) and adds them all into a single eye diagram, kept as a 2D
+histogram of how often the signal passes through each point. eye.py
+shows the result with ``--density``.
+
+eye.py plots each packet's traces one at a time, which is fine for a
+packet but not for a day of traffic. Here the work is done with numpy
+on batches of packets: packets are up-sampled together with one FFT,
+cut into the same 3 data point windows eye.py uses, and counted with a
+single ``np.bincount()``. Batches are spread over several processes and
+the histograms added at the end.
+
+Packets vary a lot in strength, so each packet is scaled so the mean
+magnitude of its bit centers is 1 before it is added.
+"""
+import sys
+import os
+import glob
+import time
+import multiprocessing
+import functools
+import numpy as np
+import argparse
+from argparse import RawTextHelpFormatter
+
+from ec_978 import PACKET_LENGTH_FISB, PACKET_LENGTH_ADSB
+
+# Number of data points in each window (same as eye.py).
+POINTS = 3
+
+# Up-sampling factor (same as eye.py smoothing).
+SCALE = 8
+
+# Number of samples in each window and the step between windows. Like
+# eye.py, windows share their end points.
+WINDOW = (POINTS * 2 * SCALE) + SCALE
+STEP = WINDOW - SCALE
+
+# Number of FIS-B bits used. All of them.
+FISB_BITS = 4416
+
+# Number of ADS-B bits used. Only the length of a short message, since
+# the rest may be noise.
+ADSB_BITS = 240
+
+# Values (after scaling) shown are from -Y_LIMIT to +Y_LIMIT.
+Y_LIMIT = 2.5
+
+# Number of files each job reads.
+FILES_PER_JOB = 64
+
+# Number of histogram rows. Set by --ybins.
+yBins = 256
+
+def upsample(packets):
+  """
+  Up-sample a batch of packets by ``SCALE`` using the FFT (like
+  ``scipy.signal.resample()``, but for all the packets at once).
+
+  Args:
+    packets (nparray): Packets of the same length, shape (n, length).
+
+  Returns:
+    nparray: Up-sampled packets, shape (n, length * SCALE).
+  """
+  length = packets.shape[1]
+  spectrum = np.fft.rfft(packets, axis=1)
+
+  padded = np.zeros((packets.shape[0], ((length * SCALE) // 2) + 1), \
+      dtype=spectrum.dtype)
+  padded[:, 0:spectrum.shape[1]] = spectrum
+
+  return np.fft.irfft(padded, length * SCALE, axis=1) * SCALE
+
+def batchHistogram(packets, numBits, yBins):
+  """
+  Add a batch of packets of one type to a new histogram.
+
+  Args:
+    packets (nparray): Packets as read (int32), shape (n, length).
+    numBits (int): Number of bits of each packet to use.
+    yBins (int): Number of histogram rows.
+
+  Returns:
+    nparray: Histogram of shape (``WINDOW``, ``yBins``) of int64.
+  """
+  # Drop the sample before the packet (see eye.py) and keep the bits
+  # we want. An even length keeps the FFT fast.
+  packets = packets[:, 1:(numBits * 2) + 1].astype(np.float64)
+
+  # Scale each packet so its bit centers (even samples now) have a mean
+  # magnitude of 1.
+  levels = np.mean(np.abs(packets[:, 0::2]), axis=1)
+  levels[levels == 0] = 1.0
+  packets = packets / levels[:, np.newaxis]
+
+  smooth = upsample(packets)
+
+  # Cut into windows: (packets, windows, WINDOW).
+  numWindows = (smooth.shape[1] - WINDOW) // STEP + 1
+  starts = np.arange(numWindows) * STEP
+  windows = smooth[:, starts[:, np.newaxis] + np.arange(WINDOW)]
+
+  # Row of each value. Values off the chart go in an extra row at
+  # each end, which is thrown away.
+  rows = (windows + Y_LIMIT) * (yBins / (2 * Y_LIMIT)) + 1
+  np.clip(rows, 0, yBins + 1, out=rows)
+
+  cells = rows.astype(np.int32) + (np.arange(WINDOW, dtype=np.int32) * \
+      (yBins + 2))
+
+  hist = np.bincount(cells.ravel(), minlength=WINDOW * (yBins + 2))
+
+  return hist.reshape(WINDOW, yBins + 2)[:, 1:yBins + 1]
+
+def histogramFiles(fnames, yBins):
+  """
+  Read packet files and add them to a new histogram. Runs in a worker
+  process.
+
+  Args:
+    fnames (list): Packet files. Type comes from the name like ec_978.py
+      (``--saveraw`` and ``--se`` names both have '.F.' or '.A.', or
+      '.S.' for short ADS-B packets from ``demod_978 -s``).
+    yBins (int): Number of histogram rows. Passed in, since workers
+      don't see ``--ybins`` unless they were forked.
+
+  Returns:
+    tuple: Tuple containing:
+
+    * Histogram of shape (``WINDOW``, ``yBins``) of int64.
+    * Number of packets used.
+  """
+  batches = {'F': [], 'A': []}
+
+  for fname in fnames:
+    parts = os.path.basename(fname).split('.')
+    if len(parts) < 4:
+      continue
+
+    # Short ADS-B packets ('S') are ADS-B.
+    pktType = 'A' if parts[2] == 'S' else parts[2]
+    if pktType not in batches:
+      continue
+
+    packetLength = PACKET_LENGTH_FISB if pktType == 'F' else PACKET_LENGTH_ADSB
+
+    with open(fname, 'rb') as bfile:
+      packetBuf = bfile.read(packetLength)
+
+    if len(packetBuf) != packetLength:
+      continue
+
+    batches[pktType].append(np.frombuffer(packetBuf, np.int32))
+
+  hist = np.zeros((WINDOW, yBins), dtype=np.int64)
+
+  for pktType, numBits in [('F', FISB_BITS), ('A', ADSB_BITS)]:
+    if len(batches[pktType]) > 0:
+      hist += batchHistogram(np.stack(batches[pktType]), numBits, yBins)
+
+  return hist, len(batches['F']) + len(batches['A'])
+
+def main(paths, pktTypes, outName, jobs):
+  """
+  Find the packet files, build the histogram and save it.
+
+  Args:
+    paths (list): Directories (all '.i32' files are used) or files.
+    pktTypes (str): 'F', 'A' or 'FA' for the types of packets to use.
+    outName (str): File to save to (numpy '.npz').
+    jobs (int): Number of processes to use.
+  """
+  startTime = time.time()
+
+  fnames = []
+  for path in paths:
+    if os.path.isdir(path):
+      fnames += glob.glob(os.path.join(path, '*.i32'))
+    else:
+      fnames.append(path)
+
+  # Short ADS-B packets ('S') are ADS-B.
+  if 'A' in pktTypes:
+    pktTypes += 'S'
+
+  fnames = [x for x in fnames if \
+      any(f'.{t}.' in os.path.basename(x) for t in pktTypes)]
+
+  chunks = [fnames[i:i + FILES_PER_JOB] for i in \
+      range(0, len(fnames), FILES_PER_JOB)]
+
+  hist = np.zeros((WINDOW, yBins), dtype=np.int64)
+  numPackets = 0
+
+  with multiprocessing.Pool(jobs) as pool:
+    for chunkHist, chunkPackets in pool.imap_unordered( \
+        functools.partial(histogramFiles, yBins=yBins), chunks):
+      hist += chunkHist
+      numPackets += chunkPackets
+
+  np.savez_compressed(outName, hist=hist, points=POINTS, \
+      yLimit=Y_LIMIT, packets=numPackets)
+
+  print(f'{numPackets} packets in {time.time() - startTime:.1f} secs, ' + \
+      f'saved to {outName}', file=sys.stderr)
+
+# Call main function
+if __name__ == "__main__":
+
+  hlpText = \
+    """eye_density.py: Build an eye diagram from many packets.
+
+Uses FIS-B and ADS-B packets saved by 'ec_978.py' with '--saveraw' or
+'--se'. Give one or more directories (all the '.i32' files are used) or
+files. All the packets are added into one eye diagram, kept as a count
+of how often the signal passes through each point. Show it with
+'eye.py --density':
+
+    ./eye_density.py raw/ -o day.npz
+    ./eye.py --density day.npz
+
+Like the smoothed eye.py diagrams, packets are up-sampled 8 times and
+each window shows 3 data points. Each packet is scaled so the mean size
+of its bit centers is 1, so strong and weak packets line up. Only the
+first 240 bits of ADS-B packets (a short message) are used.
+
+type
+====
+'F' to use only FIS-B packets, 'A' for only ADS-B. Both are used if not
+given.
+
+ybins
+=====
+Number of rows in the diagram (default 256). Values from -2.5 to +2.5
+are shown.
+"""
+  parser = argparse.ArgumentParser(description= hlpText, \
+          formatter_class=RawTextHelpFormatter)
+
+  parser.add_argument("paths", nargs='+', \
+    help='Directories or files of saved packets.')
+
+  parser.add_argument("-o", "--out", required=False, \
+    help='File to save to (default eye_density.npz).')
+  parser.add_argument("--type", choices=['F', 'A'], required=False, \
+    help='Only use FIS-B (F) or ADS-B (A) packets.')
+  parser.add_argument("--ybins", type=int, required=False, \
+    help='Number of rows in the diagram (default 256).')
+  parser.add_argument("--jobs", type=int, required=False, \
+    help='Number of processes to use (default number of CPUs).')
+
+  args = parser.parse_args()
+
+  outName = 'eye_density.npz'
+  if args.out is not None:
+    outName = args.out
+
+  pktTypes = 'FA'
+  if args.type is not None:
+    pktTypes = args.type
+
+  if args.ybins is not None:
+    yBins = args.ybins
+
+  jobs = os.cpu_count()
+  if args.jobs is not None:
+    jobs = args.jobs
+
+  main(args.paths, pktTypes, outName, jobs)
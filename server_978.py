@@ -10,6 +10,11 @@ in a write-only fashion to any client that connects to the server.
 Default port is 3333, but this can be changed with the ``--port``
 option.
 
+With ``--query``, FIS-B products are also kept in a product store
+holding the latest version of each product, and a second port answers
+snapshot queries. The store can also be used directly with
+``productStoreAdd()`` and ``productSnapshot()``.
+
 Caution: This server uses select with file numbers for both
 sockets and standard output, so probably not work on native Windows.
 """
@@ -22,6 +27,10 @@ import glob
 import socket
 import select
 import sys
+import json
+import zlib
+import socketserver
+import threading
 
 #: Maximum simultaneous connections allowed.
 MAX_CONNECTIONS = 10
@@ -29,6 +38,49 @@ MAX_CONNECTIONS = 10
 # Default TCP port to use (changable with --port).
 port = 3333
 
+# TCP port for product store queries (set by --query). None if not
+# keeping a product store.
+query_port = None
+
+# Products not heard for this many seconds are dropped from the store.
+PRODUCT_MAX_AGE = 3600
+
+# Products that start with a global block number (NEXRAD, icing, cloud
+# tops, turbulence, lightning). The block number is the geography.
+GLOBAL_BLOCK_PRODUCTS = [63, 64, 70, 71, 84, 90, 91, 103]
+
+# Generic text product (METAR, TAF, etc). The report type and location
+# are the geography.
+TEXT_PRODUCT = 413
+
+# DLAC 6-bit character set used by text products.
+DLAC_ALPHABET = '\x03ABCDEFGHIJKLMNOPQRSTUVWXYZ\x1a\t\x1e\n| !"#$%&\'()*+,-./' + \
+    '0123456789:;<=>?'
+
+# Latest version of each product. Keys are (product id, station,
+# geography), where the station is the hex of the first 6 bytes of block
+# 0 (its latitude and longitude). Values are (time, APDU bytes).
+products = {}
+
+# Time of the newest packet. Products are aged against this, so file
+# playback works.
+newestTime = 0.0
+
+# Lock for products and newestTime (queries are answered in other
+# threads).
+productLock = threading.Lock()
+
+# A heartbeat is late after this many of its intervals with none.
+HEARTBEAT_LATE_INTERVALS = 3
+
+# Time (our clock) the last '#HB' line from ec_978.py arrived, and its
+# interval in seconds. None until the first one.
+lastHeartbeatTime = None
+heartbeatInterval = None
+
+# Set while heartbeats are late, so we only warn once.
+heartbeatLate = False
+
 def extractWholeLine(buf, isFirstLine):
   """
   Return the next complete line of input if available.
@@ -89,6 +141,298 @@ def extractWholeLine(buf, isFirstLine):
 
   return line, buf, False
 
+def decodeDlac(byts, maxChars):
+  """
+  Decode DLAC text (4 characters in each 3 bytes).
+
+  Args:
+    byts (bytes): DLAC data.
+    maxChars (int): Most characters to decode.
+
+  Returns:
+    str: Decoded text.
+  """
+  chars = []
+  for i in range(0, min(len(byts) * 8 // 6, maxChars)):
+    bitPtr = i * 6
+    val = ((byts[bitPtr // 8] << 8) | \
+        (byts[bitPtr // 8 + 1] if (bitPtr // 8 + 1) < len(byts) else 0))
+    chars.append(DLAC_ALPHABET[(val >> (10 - (bitPtr % 8))) & 0x3f])
+
+  return ''.join(chars)
+
+def stationPosition(stationHex):
+  """
+  Get the latitude and longitude of a ground station from the first 6
+  bytes of block 0.
+
+  Args:
+    stationHex (str): Hex of the first 6 bytes of block 0.
+
+  Returns:
+    tuple: Latitude and longitude in degrees.
+  """
+  b = bytes.fromhex(stationHex)
+
+  rawLat = (b[0] << 15) | (b[1] << 7) | (b[2] >> 1)
+  rawLon = ((b[2] & 0x01) << 23) | (b[3] << 15) | (b[4] << 7) | (b[5] >> 1)
+
+  lat = rawLat * 360.0 / 16777216.0
+  if lat > 90:
+    lat -= 180
+
+  lon = rawLon * 360.0 / 16777216.0
+  if lon > 180:
+    lon -= 360
+
+  return round(lat, 4), round(lon, 4)
+
+def apduProduct(frame):
+  """
+  Parse the APDU header of an APDU frame and find the product id and
+  geography.
+
+  Args:
+    frame (bytes): UAT frame data (type 0).
+
+  Returns:
+    tuple: Product id and geography (str), or ``None, None`` if the frame
+    is too short or uses header options we don't handle (A, G or P flags).
+  """
+  if (len(frame) < 6) or (frame[0] & 0xe0):
+    return None, None
+
+  productId = ((frame[0] & 0x1f) << 6) | (frame[1] >> 2)
+  segmented = (frame[1] & 0x02) != 0
+  timeOption = ((frame[1] & 0x01) << 1) | (frame[2] >> 7)
+
+  # Header length depends on which time fields are present.
+  data = frame[[4, 5, 5, 6][timeOption]:]
+
+  if segmented:
+    if len(data) < 4:
+      return None, None
+
+    fileId = (data[0] << 2) | (data[1] >> 6)
+    apduNumber = ((data[2] & 0x1f) << 4) | (data[3] >> 4)
+    return productId, f'seg:{fileId}:{apduNumber}'
+
+  if (productId in GLOBAL_BLOCK_PRODUCTS) and (len(data) >= 3):
+    # Skip the element identifier (RLE or empty).
+    return productId, \
+        f'block:{((data[0] & 0x7f) << 16) | (data[1] << 8) | data[2]}'
+
+  if productId == TEXT_PRODUCT:
+    words = decodeDlac(data, 32).split()
+    return productId, ' '.join(words[:2])
+
+  # Nothing better, so each different APDU is its own product.
+  return productId, f'crc:{zlib.crc32(data):08x}'
+
+def productStoreAdd(line):
+  """
+  Add the products in a line from ``ec_978.py`` to the product store.
+  Lines other than FIS-B packets are ignored.
+
+  Args:
+    line (str): Line from ``ec_978.py`` (any output format).
+  """
+  global newestTime
+
+  if not line.startswith('+'):
+    return
+
+  fields = line.strip().split(';')
+  hexData = fields[0][1:]
+  if len(hexData) != 6 * 72 * 2:
+    return
+
+  timeValue = time.time()
+  for field in fields[1:]:
+    if field.startswith('t='):
+      try:
+        timeValue = float(field[2:])
+      except ValueError:
+        pass
+
+  dataBytes = bytes.fromhex(hexData)
+  station = hexData[0:12]
+
+  with productLock:
+    newestTime = max(newestTime, timeValue)
+
+    # Jump through UAT frames. A length of zero ends them.
+    bytePtr = 8
+    while bytePtr + 1 < len(dataBytes):
+      frameLen = (dataBytes[bytePtr] << 1) | (dataBytes[bytePtr + 1] >> 7)
+      frameType = dataBytes[bytePtr + 1] & 0x0f
+
+      if (frameLen == 0) or (bytePtr + 2 + frameLen > len(dataBytes)):
+        break
+
+      if frameType == 0:
+        frame = dataBytes[bytePtr + 2:bytePtr + 2 + frameLen]
+        productId, geography = apduProduct(frame)
+
+        if productId is not None:
+          # Delete first so the newest is at the end.
+          key = (productId, station, geography)
+          products.pop(key, None)
+          products[key] = (timeValue, frame)
+
+      bytePtr += frameLen + 2
+
+    # Drop old products (oldest are first).
+    while (len(products) > 0) and \
+        ((newestTime - next(iter(products.values()))[0]) > PRODUCT_MAX_AGE):
+      del products[next(iter(products))]
+
+def productSnapshot(productId = None, station = None):
+  """
+  Get the latest version of each product in the store.
+
+  Args:
+    productId (int): Only this product id, or ``None`` for all.
+    station (str): Only this station (hex of the first 6 bytes of
+      block 0), or ``None`` for all.
+
+  Returns:
+    list: One dictionary for each product with keys 'pid', 'station',
+    'lat', 'lon', 'geo', 't' and 'apdu' (hex).
+  """
+  with productLock:
+    items = [(x, y) for x, y in products.items() if \
+        ((productId is None) or (x[0] == productId)) and \
+        ((station is None) or (x[1] == station))]
+
+  snapshot = []
+  for key, value in items:
+    lat, lon = stationPosition(key[1])
+    snapshot.append({'pid': key[0], 'station': key[1], 'lat': lat, \
+        'lon': lon, 'geo': key[2], 't': value[0], 'apdu': value[1].hex()})
+
+  return snapshot
+
+def queryCommand(line):
+  """
+  Answer a product store query.
+
+  Commands:
+
+  * ``products [PID [STATION]]``: Latest version of each product, one
+    JSON object per line. PID can be '*' for all products.
+  * ``count``: Number of products by product id as JSON.
+
+  Args:
+    line (str): Command line received.
+
+  Returns:
+    str: Reply, ending with a blank line.
+  """
+  words = line.split()
+
+  if len(words) == 0:
+    return '\n'
+
+  if words[0] == 'count':
+    with productLock:
+      counts = {}
+      for key in products:
+        counts[key[0]] = counts.get(key[0], 0) + 1
+    return json.dumps(counts, sort_keys=True) + '\n\n'
+
+  if words[0] == 'products':
+    try:
+      productId = None
+      if (len(words) > 1) and (words[1] != '*'):
+        productId = int(words[1])
+    except ValueError:
+      return 'error bad product id\n\n'
+
+    station = words[2].lower() if len(words) > 2 else None
+
+    return ''.join(json.dumps(x) + '\n' for x in \
+        productSnapshot(productId, station)) + '\n'
+
+  return 'error unknown command\n\n'
+
+class QueryHandler(socketserver.StreamRequestHandler):
+  """
+  Handle a single query connection. Each line received is passed to
+  ``queryCommand()`` and the reply sent back.
+  """
+  def handle(self):
+    for line in self.rfile:
+      reply = queryCommand(line.decode(errors='replace'))
+      self.wfile.write(reply.encode())
+
+def startQueryServer(queryPort):
+  """
+  Start the product store query server in a background thread.
+
+  Args:
+    queryPort (int): TCP port to listen on.
+  """
+  socketserver.ThreadingTCPServer.allow_reuse_address = True
+  server = socketserver.ThreadingTCPServer(('0.0.0.0', queryPort), \
+      QueryHandler)
+  server.daemon_threads = True
+
+  thread = threading.Thread(target=server.serve_forever, daemon=True)
+  thread.start()
+
+def heartbeatLine(line):
+  """
+  Consume a heartbeat line from ``ec_978.py --hb``.
+
+  Heartbeats are only for us, so they are not sent to clients. We keep
+  the time each one arrived and its interval for ``heartbeatCheck()``.
+
+  Args:
+    line (str): Line from standard input.
+
+  Returns:
+    bool: ``True`` if the line was a heartbeat.
+  """
+  global lastHeartbeatTime, heartbeatInterval, heartbeatLate
+
+  if not line.startswith('#HB '):
+    return False
+
+  fields = dict(x.split('=', 1) for x in line[4:].strip().split(';') \
+      if '=' in x)
+
+  try:
+    heartbeatInterval = int(fields['interval']) / 1000.0
+  except (KeyError, ValueError):
+    return True
+
+  if heartbeatLate:
+    print(f'Heartbeats resumed (seq {fields.get("seq")}, ' + \
+        f'lost {fields.get("lost")}, dropped {fields.get("dropped")})', \
+        file=sys.stderr)
+    heartbeatLate = False
+
+  lastHeartbeatTime = time.time()
+  return True
+
+def heartbeatCheck():
+  """
+  Warn once if no heartbeat has arrived for ``HEARTBEAT_LATE_INTERVALS``
+  intervals. demod_978 sends heartbeats even with no packets, so this
+  means something upstream is stuck or gone, not just a quiet sky.
+  """
+  global heartbeatLate
+
+  if (lastHeartbeatTime is None) or heartbeatLate:
+    return
+
+  silence = time.time() - lastHeartbeatTime
+  if silence > heartbeatInterval * HEARTBEAT_LATE_INTERVALS:
+    print(f'No heartbeat for {silence:.1f} secs. demod_978 or ' + \
+        'ec_978.py may be stuck.', file=sys.stderr)
+    heartbeatLate = True
+
 def main():
   """
   Main server loop.
@@ -126,6 +470,11 @@ def main():
 
   server.listen(MAX_CONNECTIONS)
 
+  if query_port is not None:
+    print(f'Starting product store queries on port {query_port}', \
+        file=sys.stderr)
+    startQueryServer(query_port)
+
   # Dictionary to match fileno to socket.
   # Because we are using stdin and sockets, all information
   # in select() is done handling file numbers, as opposed to
@@ -166,7 +515,10 @@ def main():
           # Append any input that is ready to be read.
           # 100 seems a good compromise that keeps data flowing
           # smoothly. Larger numbers make the flow more sporadically.
-          stdinBuffer += sys.stdin.read(100)
+          # os.read() returns what is there rather than waiting for
+          # all 100, so a stalled sender can't stop the loop (and
+          # heartbeatCheck()).
+          stdinBuffer += os.read(filenoStdin, 100).decode()
 
         else:
             # Some other socket
@@ -198,6 +550,14 @@ def main():
       # that are not complete lines.
       line, stdinBuffer, isFirstLine = extractWholeLine(stdinBuffer, isFirstLine)
 
+      if (line != None) and heartbeatLine(line):
+        line = None
+
+      heartbeatCheck()
+
+      if (line != None) and (query_port is not None):
+        productStoreAdd(line)
+
       # Sleep for 1ms if nothing to do. Leaving this out causing runtine
       # to increase to 100%
       if line == None:
@@ -250,15 +610,43 @@ if __name__ == "__main__":
 Takes standard input (usually supplied by 'ec_978.py') and will
 send it to any connections. Will run until interrupted.
 
-All data is sent in complete lines."""
+All data is sent in complete lines.
+
+query
+=====
+Keeps the latest version of each FIS-B product (by product id, ground
+station and geography) and answers queries on this port, so clients
+can get the current picture without replaying the stream. Geography is
+the block number for global block products (NEXRAD, etc), the report
+type and location for text products (413), or the segment for segmented
+products. Other products are kept by their contents. Products not seen
+for an hour are dropped. Send a line with a command; the reply ends with
+a blank line:
+
+  products [PID [STATION]]  One JSON object per product. PID can be '*'.
+                            STATION is the hex of the first 6 bytes of
+                            block 0.
+  count                     Number of products by product id.
+
+heartbeats
+==========
+Heartbeat lines ('#HB ...') from 'ec_978.py --hb' are not sent to
+clients. If they stop for 3 of their intervals a warning is written to
+standard error, and another when they start again. Nothing is checked
+until the first heartbeat arrives."""
   parser = argparse.ArgumentParser(description= hlpText, \
           formatter_class=RawTextHelpFormatter)
   
   parser.add_argument("--port", type=int, required=False, help='Port number to use.')
+  parser.add_argument("--query", type=int, required=False, \
+    help='Port for product store queries.')
 
   args = parser.parse_args()
 
   if args.port:
     port = args.port
 
+  if args.query:
+    query_port = args.query
+
   main()
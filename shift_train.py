@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+
+"""
+shift_train.py - Build shift tables for ec_978.py
+=================================================
+
+Uses packets saved by ec_978.py (``--saveraw`` or ``--se``) to find the
+order shifts should be tried in (see ``SHIFT_BY_PROBABILITY`` in
+ec_978.py).
+
+Every shift is tried on every FIS-B block and ADS-B message. Then,
+like ``SHIFT_BY_PROBABILITY`` was made, we pick the shift that decodes
+the most blocks and messages, remove those from contention, and repeat.
+
+The tables are written to standard output and are loaded by ec_978.py
+with ``--shifts``. A report of the expected number of attempts for each
+decode, compared with ``SHIFT_BY_PROBABILITY``, is written to standard
+error.
+"""
+import sys
+import os
+import glob
+import bisect
+import multiprocessing
+import numpy as np
+import argparse
+from argparse import RawTextHelpFormatter
+
+from ec_978 import SHIFT_BY_PROBABILITY, SHIFT_LEVEL_BUCKETS, \
+    PACKET_LENGTH_FISB, PACKET_LENGTH_ADSB, rsFisb, rsAdsbS, rsAdsbL, \
+    fisbExtractBlockBits, adsbExtractBlockBits, applyShift, packAndTest, \
+    adsbPayloadTypeValid
+
+# Fewest decodable blocks and messages needed to make a table for a
+# level bucket. Set by --min.
+minDecodes = 200
+
+def fileInfo(fname):
+  """
+  Get the packet type and signal level from a file name.
+
+  ``--saveraw`` files are named like '1646349680.227.F.i32' and have no
+  signal level. ``--se`` files start with the attribute string, such as
+  '1646349680.227000.F.01103350.2.-0399...', where the 4th part is the
+  signal level. Short ADS-B packets from ``demod_978 -s`` ('S') are
+  ADS-B.
+
+  Args:
+    fname (str): File name.
+
+  Returns:
+    tuple: Tuple containing:
+
+    * 'F' for FIS-B, 'A' for ADS-B, or ``None`` if not a packet file.
+    * Signal level (float), or ``None`` if not in the name.
+  """
+  parts = os.path.basename(fname).split('.')
+
+  if (len(parts) < 4) or (parts[2] not in ['F', 'A', 'S']):
+    return None, None
+
+  level = None
+  if len(parts) > 4:
+    try:
+      level = round(int(parts[3]) / 1000000.0, 2)
+    except ValueError:
+      pass
+
+  return ('A' if parts[2] == 'S' else parts[2]), level
+
+def decodingShifts(fname):
+  """
+  Try every shift on every block of a FIS-B packet, or on an ADS-B
+  packet (both short and long).
+
+  Args:
+    fname (str): Packet file.
+
+  Returns:
+    tuple: Tuple containing:
+
+    * 'F' for FIS-B, 'A' for ADS-B, or ``None`` if the file can't be used.
+    * Signal level (float), or ``None``.
+    * List with a set of the shifts that decoded, one for each FIS-B
+      block or the ADS-B message.
+  """
+  pktType, level = fileInfo(fname)
+  if pktType is None:
+    return None, None, []
+
+  packetLength = PACKET_LENGTH_FISB if pktType == 'F' else PACKET_LENGTH_ADSB
+
+  with open(fname, 'rb') as bfile:
+    packetBuf = bfile.read(packetLength)
+
+  if len(packetBuf) != packetLength:
+    return None, None, []
+
+  # Numpy will convert the bytes to int32's
+  packet = np.frombuffer(packetBuf, np.int32)
+
+  units = []
+
+  if pktType == 'F':
+    for block in range(0, 6):
+      bits, bitsBefore, bitsAfter = fisbExtractBlockBits(packet, 1, block)
+
+      units.append({shift for shift in SHIFT_BY_PROBABILITY if \
+          packAndTest(rsFisb, applyShift(bits, bitsBefore, \
+          bitsAfter, shift))[1] >= 0})
+  else:
+    shifts = set()
+    for isShort, rs in [(True, rsAdsbS), (False, rsAdsbL)]:
+      bits, bitsBefore, bitsAfter = adsbExtractBlockBits(packet, 1, isShort)
+
+      for shift in SHIFT_BY_PROBABILITY:
+        hexBlock, errs = packAndTest(rs, applyShift(bits, \
+            bitsBefore, bitsAfter, shift))
+        if (errs >= 0) and adsbPayloadTypeValid(hexBlock):
+          shifts.add(shift)
+
+    units.append(shifts)
+
+  return pktType, level, units
+
+def greedyOrder(units, maxShifts):
+  """
+  Find the shift that decodes the most blocks and messages, remove
+  those from contention and repeat. Ties go to the shift earlier in
+  ``SHIFT_BY_PROBABILITY``.
+
+  Args:
+    units (list): Sets of shifts that decoded each block or message.
+    maxShifts (int): Most shifts in the table.
+
+  Returns:
+    list: Shifts in the order to try them. Shifts that never decoded
+    anything not already decoded are added at the end in
+    ``SHIFT_BY_PROBABILITY`` order, up to ``maxShifts``.
+  """
+  remaining = [x for x in units if len(x) > 0]
+  order = []
+
+  while (len(remaining) > 0) and (len(order) < maxShifts):
+    pool = [x for x in SHIFT_BY_PROBABILITY if x not in order]
+    best = max(pool, key=lambda x: sum(1 for y in remaining if x in y))
+
+    order.append(best)
+    remaining = [x for x in remaining if best not in x]
+
+  for shift in SHIFT_BY_PROBABILITY:
+    if len(order) >= maxShifts:
+      break
+    if shift not in order:
+      order.append(shift)
+
+  return order
+
+def expectedAttempts(order, units):
+  """
+  Work out the average number of shifts tried for each decode.
+
+  Args:
+    order (list): Shifts in the order tried.
+    units (list): Sets of shifts that decoded each block or message.
+
+  Returns:
+    tuple: Tuple containing:
+
+    * Average number of shifts tried for the blocks and messages that
+      decode with a shift in ``order``.
+    * Number of blocks and messages that decode with some shift, but
+      none in ``order``.
+  """
+  tries = 0
+  decodes = 0
+  lost = 0
+
+  for unit in units:
+    if len(unit) == 0:
+      continue
+
+    for i, shift in enumerate(order):
+      if shift in unit:
+        tries += i + 1
+        decodes += 1
+        break
+    else:
+      lost += 1
+
+  return (tries / decodes if decodes > 0 else 0.0), lost
+
+def main(paths, byType, byLevel, maxShifts, jobs):
+  """
+  Find the packet files, try all the shifts on them, and write the
+  tables and report.
+
+  Args:
+    paths (list): Directories (all '.i32' files are used) or files.
+    byType (bool): ``True`` to make separate FIS-B and ADS-B tables.
+    byLevel (bool): ``True`` to make tables for each level bucket.
+    maxShifts (int): Most shifts in a table.
+    jobs (int): Number of processes to use.
+  """
+  fnames = []
+  for path in paths:
+    if os.path.isdir(path):
+      fnames += glob.glob(os.path.join(path, '*.i32'))
+    else:
+      fnames.append(path)
+
+  # Sets of decoding shifts by (packet type, level bucket).
+  groups = {}
+
+  with multiprocessing.Pool(jobs) as pool:
+    for pktType, level, units in pool.imap_unordered(decodingShifts, \
+        fnames, chunksize=16):
+      if pktType is None:
+        continue
+
+      keyType = pktType if byType else '*'
+      groups.setdefault((keyType, '*'), []).extend(units)
+
+      if byLevel and (level is not None):
+        bucket = bisect.bisect_left(SHIFT_LEVEL_BUCKETS, level)
+        groups.setdefault((keyType, bucket), []).extend(units)
+
+  print(f'# Made by shift_train.py from {len(fnames)} files.')
+
+  print(f'{"type":>4} {"level":>5} {"units":>7} {"decode":>7} ' + \
+      f'{"default":>7} {"trained":>7} {"lost":>5}', file=sys.stderr)
+
+  for key in sorted(groups, key=lambda x: (x[0], str(x[1]))):
+    units = groups[key]
+    numDecodable = sum(1 for x in units if len(x) > 0)
+
+    # Level bucket tables need enough decodes to mean anything.
+    if (key[1] != '*') and (numDecodable < minDecodes):
+      continue
+
+    order = greedyOrder(units, maxShifts)
+
+    defaultTries, _ = expectedAttempts(SHIFT_BY_PROBABILITY, units)
+    trainedTries, lost = expectedAttempts(order, units)
+
+    print(f'{key[0]} {key[1]} ' + ' '.join(f'{x:g}' for x in order))
+
+    print(f'{key[0]:>4} {str(key[1]):>5} {len(units):>7} {numDecodable:>7} ' + \
+        f'{defaultTries:>7.3f} {trainedTries:>7.3f} {lost:>5}', file=sys.stderr)
+
+# Call main function
+if __name__ == "__main__":
+
+  hlpText = \
+    """shift_train.py: Build shift tables for ec_978.py.
+
+Uses FIS-B and ADS-B packets saved by 'ec_978.py' with '--saveraw' or
+'--se' to find the best order to try shifts in at your site. Give one or
+more directories (all the '.i32' files are used) or files. Tables are
+written to standard output. Use them with 'ec_978.py --shifts':
+
+    ./shift_train.py --type --level errors/ raw/ > my.shifts
+    ./ec_978.py --shifts my.shifts
+
+Every shift is tried on every FIS-B block and ADS-B message (short and
+long). The shift decoding the most is put first. Those decodes are
+removed and this is repeated until all decodes are covered. Shifts that
+didn't add anything are added at the end in the usual order.
+
+A report goes to standard error. For each table it shows the number of
+blocks and messages ('units'), the number that decoded with any shift
+('decode'), the average number of shifts tried for each decode using
+the usual order ('default') and the new table ('trained'), and the number
+of decodes lost if '--max' cut the table short ('lost').
+
+type, level
+===========
+Normally one table is made for all packets. '--type' makes one table
+for FIS-B and one for ADS-B. '--level' also makes a table for each signal
+level bucket with at least 200 decodes (see '--min'). Only '--se' files
+have the signal level in their name. ec_978.py uses the most specific
+table there is for each packet.
+
+max
+===
+Limits the number of shifts in a table. Shifts at the end of the table
+rarely decode anything, but are tried on every packet that fails. Cutting
+the table short saves that time at the cost of the decodes shown in
+'lost'.
+"""
+  parser = argparse.ArgumentParser(description= hlpText, \
+          formatter_class=RawTextHelpFormatter)
+
+  parser.add_argument("paths", nargs='+', \
+    help='Directories or files of saved packets.')
+
+  parser.add_argument("--type", \
+    help='Make separate FIS-B and ADS-B tables.', action='store_true')
+  parser.add_argument("--level", \
+    help='Make tables for each signal level.', action='store_true')
+  parser.add_argument("--min", type=int, required=False, \
+    help='Fewest decodes for a signal level table (default 200).')
+  parser.add_argument("--max", type=int, required=False, \
+    help='Most shifts in a table.')
+  parser.add_argument("--jobs", type=int, required=False, \
+    help='Number of processes to use (default number of CPUs).')
+
+  args = parser.parse_args()
+
+  if args.min is not None:
+    minDecodes = args.min
+
+  maxShifts = len(SHIFT_BY_PROBABILITY)
+  if args.max is not None:
+    maxShifts = args.max
+
+  jobs = os.cpu_count()
+  if args.jobs is not None:
+    jobs = args.jobs
+
+  main(args.paths, args.type, args.level, maxShifts, jobs)